@@ -0,0 +1,61 @@
+#include "builtin_catalog.hpp"
+#include "args.hpp"
+#include "parser.hpp"
+#include "stats.hpp"
+#include <cstdio>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <tuple>
+#include <unordered_set>
+
+class CatalogSymbolTable : public glslang::TSymbolTable {
+public:
+    // a symbol of an upper level hides the one with the same mangled name below it
+    void get_all_symbols(PrefixIndex<glslang::TSymbol*>& names)
+    {
+        std::unordered_set<std::string_view> seen;
+        for (int level = currentLevel(); level >= 0; --level) {
+            for (auto const& [mangled, sym] : table[level]->get_level()) {
+                if (seen.insert({mangled.c_str(), mangled.size()}).second) {
+                    names.add({sym->getName().c_str(), sym->getName().size()}, sym);
+                }
+            }
+        }
+    }
+};
+
+BuiltinCatalog const* BuiltinCatalog::get(const int version, EProfile profile, EShLanguage stage,
+                                          glslang::SpvVersion const& spv)
+{
+    using Key = std::tuple<int, int, int, unsigned int, int, int, int, bool>;
+    static std::mutex mutex;
+    static std::map<Key, std::unique_ptr<BuiltinCatalog>> catalogs;
+    // the tables are never freed, parsers adopt their levels and the names of the catalogs point into them
+    static glslang::TPoolAllocator* pool = new glslang::TPoolAllocator;
+
+    Key key = {version, profile, stage, spv.spv, spv.vulkanGlsl, spv.vulkan, spv.openGl, spv.vulkanRelaxed};
+
+    static auto& cache_stats = Stats::get().cache("builtinCatalog");
+    std::lock_guard<std::mutex> lock(mutex);
+    auto& catalog = catalogs[key];
+    cache_stats.access(catalog != nullptr);
+    if (catalog) {
+        return catalog.get();
+    }
+
+    auto* previous = &glslang::GetThreadPoolAllocator();
+    glslang::SetThreadPoolAllocator(pool);
+    auto* table = new CatalogSymbolTable;
+    if (!add_stage_builtin_symbols(*table, &kDefaultTBuiltInResource, version, profile, stage, spv)) {
+        fprintf(stderr, "build builtin catalog failed. version = %d, profile = %d, stage = %d\n", version,
+                (int)profile, (int)stage);
+    }
+    glslang::SetThreadPoolAllocator(previous);
+
+    catalog.reset(new BuiltinCatalog);
+    catalog->table_ = table;
+    table->get_all_symbols(catalog->names_);
+    catalog->names_.build();
+    return catalog.get();
+}
@@ -0,0 +1,33 @@
+#ifndef __GLSLX_BUILTIN_CATALOG_HPP__
+#define __GLSLX_BUILTIN_CATALOG_HPP__
+#include "glslang/MachineIndependent/SymbolTable.h"
+#include "glslang/Public/ShaderLang.h"
+#include "prefix_index.hpp"
+#include <string_view>
+
+// built-in variables and functions of a language, collected once per stage, version, profile and spir-v
+// version and shared by every Doc of that language. extensions are not part of the key, glslang declares
+// the built-ins of every extension a version knows and only checks the #extension when they are used.
+// catalogs, their symbols and the symbol tables parsers adopt the built-ins from live as long as the process
+// and never change.
+class BuiltinCatalog {
+public:
+    using Range = PrefixIndex<glslang::TSymbol*>::Range;
+
+    static BuiltinCatalog const* get(const int version, EProfile profile, EShLanguage stage,
+                                     glslang::SpvVersion const& spv);
+
+    Range lookup(std::string_view prefix) const { return names_.lookup(prefix); }
+    Range find(std::string_view name) const { return names_.find(name); }
+    Range all() const { return names_.all(); }
+    size_t size() const { return names_.all().size(); }
+    // read only, a parser adopts its levels and pushes its own scope above them
+    glslang::TSymbolTable& table() const { return *table_; }
+
+private:
+    BuiltinCatalog() = default;
+
+    glslang::TSymbolTable* table_ = nullptr;
+    PrefixIndex<glslang::TSymbol*> names_;
+};
+#endif
@@ -1,13 +1,19 @@
 #include "completion.hpp"
+#include "fuzzy_match.hpp"
 #include "glslang/Include/Common.h"
 #include "glslang/Include/PoolAlloc.h"
 #include "parser.hpp"
 #include <cstdio>
+#include <algorithm>
 #include <cstring>
 #include <iostream>
+#include <map>
 #include <memory>
+#include <mutex>
 #include <stack>
 #include <tuple>
+#include <unordered_map>
+#include <unordered_set>
 #include <vector>
 
 std::vector<const char*> __keywords = {
@@ -113,9 +119,248 @@ std::vector<const char*> __keywords = {
     "constant_id", "push_constant"};
 
 extern int yylex(YYSTYPE*, glslang::TParseContext&);
+
+using ItemIndex = PrefixIndex<CompletionItemPtr>;
+
+// items are named by their label, the index keeps them alive
+static void add_item(ItemIndex& index, CompletionResult result)
+{
+    auto item = make_completion_item(std::move(result), true);
+    std::string_view label = item->result.label;
+    index.add(label, std::move(item));
+}
+
+// detail is looked up on completionItem/resolve, most items are never looked at
+static CompletionItemPtr typed_item(std::string const& label, CompletionItemKind kind, DocIR::StrId type)
+{
+    auto item = std::make_shared<CompletionItem>();
+    item->result = {label, kind, "", "", label, InsertTextFormat::PlainText};
+    item->type = type;
+    return item;
+}
+
+// a type as the signatures of user functions show it, the name of a struct or the basic type
+static std::string const& shape_name(DocIR const& ir, DocIR::Shape const& shape)
+{
+    return shape.struct_index != DocIR::kNone ? ir.str(ir.structs()[shape.struct_index].name) : ir.str(shape.basic);
+}
+
+static ItemIndex const& keyword_items()
+{
+    static ItemIndex const items = [] {
+        ItemIndex index;
+        for (auto* keyword : __keywords) {
+            add_item(index, {keyword, CompletionItemKind::Keyword, "", "", keyword, InsertTextFormat::PlainText});
+        }
+        index.build();
+        return index;
+    }();
+    return items;
+}
+
+static CompletionResult builtin_result(glslang::TSymbol* sym)
+{
+    if (auto* var = sym->getAsVariable()) {
+        std::string label = var->getName().c_str();
+        std::string detail = var->getType().getCompleteString(true).c_str();
+        return {label, CompletionItemKind::Variable, detail, "", label, InsertTextFormat::PlainText};
+    }
+
+    const auto* func = sym->getAsFunction();
+    std::string func_name = func->getName().c_str();
+    std::string return_type;
+    if (func->getType().isStruct()) {
+        return_type = func->getType().getTypeName().c_str();
+    } else {
+        return_type = func->getType().getBasicTypeString().c_str();
+    }
+
+    std::string args_list;
+    std::string args_list_snippet;
+
+    for (int i = 0; i < func->getParamCount(); ++i) {
+        const auto& arg = (*func)[i];
+        auto const& arg_type = *arg.type;
+        std::string arg_type_str;
+        if (arg_type.isStruct()) {
+            arg_type_str = arg_type.getTypeName().c_str();
+        } else if (arg_type.isVector()) {
+            arg_type_str = arg_type.getCompleteString(true, false, false).c_str();
+        } else {
+            arg_type_str = arg_type.getBasicTypeString().c_str();
+        }
+
+        const char* arg_name = arg.name ? arg.name->c_str() : "";
+        args_list_snippet += "${" + std::to_string(i + 1) + ":" + arg_type_str + " " + arg_name + "}, ";
+        args_list += arg_type_str + " " + arg_name + ", ";
+    }
+
+    if (args_list_snippet.size() > 2) {
+        args_list_snippet.resize(args_list_snippet.size() - 2);
+        args_list.resize(args_list.size() - 2);
+    }
+    std::string detail = return_type + " " + func_name + "(" + args_list + ")";
+    std::string insert_text = func_name + "(" + args_list_snippet + ")";
+
+    return {func_name, CompletionItemKind::Function, detail, "", insert_text, InsertTextFormat::Snippet};
+}
+
+static CompletionResult function_result(DocIR const& ir, DocIR::Function const& func)
+{
+    auto const& symbol = ir.symbols()[func.symbol];
+    auto const& label = ir.str(symbol.name);
+    std::string return_type = shape_name(ir, symbol.shape);
+
+    std::string args_list_snippet;
+    std::string args_list;
+    for (uint32_t i = 0; i < func.param_count; ++i) {
+        auto const& arg = ir.symbols()[func.symbol + 1 + i];
+        std::string const& arg_type_str = shape_name(ir, arg.shape);
+        std::string const& arg_name = ir.str(arg.name);
+
+        args_list_snippet += "${" + std::to_string(i + 1) + ":" + arg_type_str + " " + arg_name + "}, ";
+        args_list += arg_type_str + " " + arg_name + ", ";
+    }
+
+    if (args_list_snippet.size() > 2) {
+        args_list_snippet.resize(args_list_snippet.size() - 2);
+        args_list.resize(args_list.size() - 2);
+    }
+    std::string detail = return_type + " " + label + "(" + args_list + ")";
+    std::string insert_text = label + "(" + args_list_snippet + ")";
+
+    return {label, CompletionItemKind::Function, detail, "", insert_text, InsertTextFormat::Snippet};
+}
+
+// user functions of the last parse of each open document, formatted on the first request after it
+struct FunctionItems {
+    uint64_t parse_id;
+    std::shared_ptr<const ItemIndex> items;
+};
+static std::mutex function_items_mutex;
+static std::unordered_map<std::string, FunctionItems> function_items_cache;
+
+static std::shared_ptr<const ItemIndex> function_items(Doc& doc)
+{
+    std::lock_guard<std::mutex> lock(function_items_mutex);
+    auto& entry = function_items_cache[doc.uri()];
+    if (entry.items && entry.parse_id == doc.parse_id()) {
+        return entry.items;
+    }
+
+    auto items = std::make_shared<ItemIndex>();
+    if (auto const* ir = doc.ir()) {
+        for (auto const& [name, func] : ir->functions_by_prefix("")) {
+            add_item(*items, function_result(*ir, ir->functions()[func]));
+        }
+    }
+    items->build();
+
+    entry = {doc.parse_id(), items};
+    return items;
+}
+
+void forget_completion_items(std::string const& uri)
+{
+    std::lock_guard<std::mutex> lock(function_items_mutex);
+    function_items_cache.erase(uri);
+}
+
+// the type of a link of an access chain, a shape of the IR or the type of a built-in variable.
+// references are seen through.
+class ChainType {
+public:
+    ChainType() = default;
+    ChainType(DocIR const& ir, DocIR::Shape const& shape) : ir_(&ir), shape_(shape) {}
+    explicit ChainType(const glslang::TType& builtin)
+        : builtin_(builtin.isReference() ? builtin.getReferentType() : &builtin)
+    {
+    }
+
+    bool is_struct() const { return builtin_ ? builtin_->isStruct() : shape_.struct_index != DocIR::kNone; }
+    bool is_vector() const { return builtin_ ? builtin_->isVector() : shape_.vector_size > 0; }
+    int vector_size() const { return builtin_ ? builtin_->getVectorSize() : shape_.vector_size; }
+    int array_dims() const
+    {
+        if (builtin_)
+            return builtin_->isArray() ? builtin_->getArraySizes()->getNumDims() : 0;
+        return shape_.array_dims;
+    }
+    std::string basic() const { return builtin_ ? builtin_->getBasicTypeString().c_str() : ir_->str(shape_.basic); }
+
+    // the type of the member named name of a struct
+    bool field(std::string const& name, ChainType& type) const
+    {
+        if (builtin_) {
+            for (auto const& member : *builtin_->getStruct()) {
+                if (member.type->getFieldName() == name.c_str()) {
+                    type = ChainType(*member.type);
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        auto const& s = ir_->structs()[shape_.struct_index];
+        for (uint32_t i = s.first_field; i < s.first_field + s.field_count; ++i) {
+            auto const& f = ir_->fields()[i];
+            if (ir_->str(f.name) == name) {
+                type = ChainType(*ir_, f.shape);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // members of a struct starting with prefix, the components of a vector
+    void add_members(std::string const& prefix, CompletionResultSet& results) const
+    {
+        auto match_prefix = [&prefix](std::string const& name) { return name.compare(0, prefix.size(), prefix) == 0; };
+
+        if (is_vector()) {
+            std::string tyname = basic();
+            const char* fields[] = {"x", "y", "z", "w"};
+            for (auto i = 0; i < vector_size(); ++i) {
+                if (match_prefix(fields[i])) {
+                    results.variables.push_back(make_completion_item({fields[i], CompletionItemKind::Field,
+                                                                      tyname + " " + fields[i], "", fields[i],
+                                                                      InsertTextFormat::PlainText}));
+                }
+            }
+            return;
+        }
+
+        if (builtin_) {
+            // a handful of members, printed right away
+            for (auto const& member : *builtin_->getStruct()) {
+                std::string label = member.type->getFieldName().c_str();
+                if (match_prefix(label)) {
+                    results.variables.push_back(make_completion_item({label, CompletionItemKind::Field,
+                                                                      print_type(*member.type), "", label,
+                                                                      InsertTextFormat::PlainText}));
+                }
+            }
+            return;
+        }
+
+        auto const& s = ir_->structs()[shape_.struct_index];
+        for (uint32_t i = s.first_field; i < s.first_field + s.field_count; ++i) {
+            auto const& f = ir_->fields()[i];
+            if (match_prefix(ir_->str(f.name))) {
+                results.variables.push_back(typed_item(ir_->str(f.name), CompletionItemKind::Field, f.type));
+            }
+        }
+    }
+
+private:
+    DocIR const* ir_ = nullptr;
+    DocIR::Shape shape_;
+    const glslang::TType* builtin_ = nullptr;
+};
+
 struct InputStackState {
     int kind; // 0 for lex. 1 for struct 2 for arr 3 scalar
-    const glslang::TType* ttype;
+    ChainType type;
     const YYSTYPE* stype;
     int tok;
     int reduce_n_ = 0;
@@ -123,9 +368,11 @@ struct InputStackState {
 
 class CompletionHelper {
 public:
-    CompletionHelper(Doc& doc, const int line, const int col, std::vector<const char*> const& keywrods,
+    CompletionHelper(DocIR const& ir, BuiltinCatalog const* catalog, const int line, const int col,
+                     ItemIndex const& keywords, ItemIndex const& builtins, ItemIndex const& funcs,
                      std::vector<const char*> const& extentions)
-        : doc_(doc), line_(line), col_(col), keywrods_(keywrods), extentions_(extentions)
+        : ir_(ir), catalog_(catalog), line_(line), col_(col), keywords_(keywords), builtins_(builtins), funcs_(funcs),
+          extentions_(extentions)
     {
     }
 
@@ -156,7 +403,7 @@ public:
             switch (state) {
             case START:
                 if (tok == IDENTIFIER) {
-                    input_stack.push({0, nullptr, &stype, tok});
+                    input_stack.push({0, {}, &stype, tok});
                     state = EXPECT_DOT_LBRACKET;
                 } else {
                     // err
@@ -169,14 +416,14 @@ public:
                         return;
                     }
 
-                    input_stack.push({0, nullptr, &stype, tok});
+                    input_stack.push({0, {}, &stype, tok});
                     state = EXPECT_IDENTIFIER;
                     break;
                 } else if (tok == LEFT_BRACKET) {
                     if (!reduce_arr_(input_stack)) {
                         return;
                     }
-                    input_stack.push({0, nullptr, &stype, tok});
+                    input_stack.push({0, {}, &stype, tok});
                     state = EXPECT_RBRACKET;
                 } else {
                     return;
@@ -185,10 +432,10 @@ public:
             case EXPECT_IDENTIFIER: {
                 auto const& [nstype, ntok] = lex_info[i + 1];
                 if (ntok == -1) {
-                    input_stack.push({0, nullptr, &stype, tok});
+                    input_stack.push({0, {}, &stype, tok});
                 } else if (tok == IDENTIFIER) {
                     if (input_stack.top().kind == 0 && input_stack.top().tok == DOT) {
-                        input_stack.push({0, nullptr, &stype, tok});
+                        input_stack.push({0, {}, &stype, tok});
                         if (!reduce_field_(input_stack)) {
                             return;
                         }
@@ -212,12 +459,45 @@ public:
         }
     }
 
+    // a bare identifier, anonymous block members complete like variables
+    void do_complete_identifier(std::string const& prefix, CompletionResultSet& results)
+    {
+        do_complete_var_prefix_(prefix, results);
+        do_complete_type_prefix_(prefix, results);
+        do_complete_keywords_prefix_(prefix, results);
+        do_complete_builtin_prefix_(prefix, results);
+        do_complete_extention_prefix_(prefix, results);
+
+        for (auto const& [name, block] : ir_.globals_by_prefix("anon@")) {
+            ChainType type(ir_, ir_.symbols()[block].shape);
+            if (type.is_struct()) {
+                type.add_members(prefix, results);
+            }
+        }
+    }
+
+    void do_complete_extension(std::string const& prefix, CompletionResultSet& results)
+    {
+        do_complete_extention_prefix_(prefix, results);
+    }
+
 private:
-    Doc& doc_;
+    DocIR const& ir_;
+    BuiltinCatalog const* catalog_;
     const int line_, col_;
-    std::vector<const char*> const& keywrods_;
+    ItemIndex const& keywords_;
+    ItemIndex const& builtins_;
+    ItemIndex const& funcs_;
     std::vector<const char*> const& extentions_;
 
+    void add_variables_(DocIR::NameRange const& symbols, CompletionResultSet& results)
+    {
+        for (auto const& [name, sym] : symbols) {
+            results.variables.push_back(
+                typed_item(std::string(name), CompletionItemKind::Variable, ir_.symbols()[sym].type));
+        }
+    }
+
     void do_complete_exp_(std::stack<InputStackState>& input_stack, CompletionResultSet& results)
     {
         if (input_stack.top().kind != 0) {
@@ -241,122 +521,58 @@ private:
             auto top = input_stack.top();
             input_stack.pop();
             if (top.kind != 0) {
-                auto* func = doc_.lookup_func_by_line(line_);
-                auto symbols = doc_.lookup_symbols_by_prefix(func, input.stype->lex.string->c_str());
-                for (auto* sym : symbols) {
-                    std::string label = sym->getName().c_str();
-                    std::string detail = sym->getType().getCompleteString(true, false, false).c_str();
-                    CompletionResult r = {label, CompletionItemKind::Variable, detail, "", label};
-                    results.variables.emplace_back(r);
-                }
+                add_variables_(ir_.globals_by_prefix(prefix), results);
+                add_variables_(ir_.locals_by_prefix(ir_.function_at(line_), prefix), results);
             } else if (top.tok == DOT) {
                 if (input_stack.empty())
                     return;
-                auto& [kind, ttype, stype, tok, _] = input_stack.top();
+                auto const& [kind, type, stype, tok, _] = input_stack.top();
                 if (kind != 1) {
                     return;
                 }
 
-                do_complete_struct_field_(ttype, prefix, results);
+                type.add_members(prefix, results);
             }
         } else if (input.tok == DOT) {
             if (input_stack.empty())
                 return;
 
-            auto& [kind, ttype, stype, tok, _] = input_stack.top();
+            auto const& [kind, type, stype, tok, _] = input_stack.top();
             if (kind != 1) {
                 return;
             }
 
-            if (ttype->isVector()) {
-                std::string tyname = ttype->getBasicTypeString().c_str();
-                const char* fields[] = {"x", "y", "z", "w"};
-                for (auto i = 0; i < ttype->getVectorSize(); ++i) {
-                    results.variables.push_back({fields[i], CompletionItemKind::Field, tyname + " " + fields[i], "",
-                                                 fields[i], InsertTextFormat::PlainText});
-                }
-            } else {
-                auto& members = *ttype->getStruct();
-                for (int i = 0; i < members.size(); ++i) {
-                    auto field = members[i].type;
-                    auto label = field->getFieldName().c_str();
-                    auto kind = CompletionItemKind::Field;
-                    auto detail = field->getCompleteString(true, false, false);
-                    auto doc = "";
-                    results.variables.push_back({label, kind, detail.c_str(), doc, label, InsertTextFormat::PlainText});
-                }
-            }
+            type.add_members("", results);
         }
     }
 
     void do_complete_var_prefix_(std::string const& prefix, CompletionResultSet& results)
     {
-        auto* func = doc_.lookup_func_by_line(line_);
-        auto symbols = doc_.lookup_symbols_by_prefix(func, prefix);
-        for (auto const& sym : symbols) {
-            auto detail = sym->getType().getCompleteString(true, false, false);
-            auto label = sym->getName().c_str();
+        add_variables_(ir_.globals_by_prefix(prefix), results);
+        add_variables_(ir_.locals_by_prefix(ir_.function_at(line_), prefix), results);
 
-            CompletionResult r = {label, CompletionItemKind::Variable, detail.c_str(), "", label};
-            results.variables.push_back(r);
+        for (auto const& [name, item] : funcs_.lookup(prefix)) {
+            results.funcs.push_back(item);
         }
+    }
 
-        auto match_prefix = [&prefix](std::string const& field) {
-            if (prefix.empty())
-                return true;
-
-            return prefix == field.substr(0, prefix.size());
-        };
-
-        auto& func_defs = doc_.func_defs();
-
-        for (const auto& func : func_defs) {
-            if (!match_prefix(func.def->getName().c_str())) {
-                continue;
-            }
-
-            const auto& label = func.name;
-            std::string return_type;
-            auto const& rtype = func.def->getType();
-            if (rtype.isStruct()) {
-                return_type = rtype.getTypeName();
-            } else {
-                return_type = rtype.getBasicTypeString();
-            }
+    // the type of the variable named name in the function at line_, a global or a built-in
+    bool variable_type_(std::string const& name, ChainType& type)
+    {
+        if (auto* sym = ir_.find_variable(ir_.function_at(line_), name)) {
+            type = ChainType(ir_, sym->shape);
+            return true;
+        }
 
-            std::string args_list_snippet;
-            std::string args_list;
-            for (int i = 0; i < func.args.size(); ++i) {
-                auto* arg = func.args[i];
-                char buf[128];
-                auto const& arg_type = arg->getType();
-                const char* arg_type_str;
-                if (arg_type.isStruct()) {
-                    arg_type_str = arg_type.getTypeName().c_str();
-                } else {
-                    arg_type_str = arg_type.getBasicTypeString().c_str();
+        if (catalog_) {
+            for (auto const& [builtin_name, sym] : catalog_->find(name)) {
+                if (auto* var = sym->getAsVariable()) {
+                    type = ChainType(var->getType());
+                    return true;
                 }
-
-                snprintf(buf, sizeof(buf), "${%d:%s %s}", i + 1, arg_type_str, arg->getName().c_str());
-
-                args_list_snippet += buf;
-                args_list_snippet += ", ";
-                args_list = args_list + arg_type_str + " " + arg->getName().c_str() + ", ";
-            }
-
-            if (args_list_snippet.size() > 2) {
-                args_list_snippet.pop_back();
-                args_list_snippet.pop_back();
-                args_list.pop_back();
-                args_list.pop_back();
             }
-            std::string detail = return_type + " " + label + "(" + args_list + ")";
-            std::string insert_text = label + "(" + args_list_snippet + ")";
-
-            CompletionResult r = {label,       CompletionItemKind::Function, detail, "",
-                                  insert_text, InsertTextFormat::Snippet};
-            results.funcs.push_back(r);
         }
+        return false;
     }
 
     bool reduce_field_(std::stack<InputStackState>& input_stack)
@@ -368,8 +584,6 @@ private:
         auto s = input_stack.top();
         input_stack.pop();
 
-        auto& members = *s.ttype->getStruct();
-        int i = 0;
         int kind = 0;
 
         if (field.kind != 0 || field.tok != IDENTIFIER) {
@@ -380,32 +594,20 @@ private:
             return false;
         }
 
-        if (s.kind != 1 || !s.ttype->isStruct()) {
+        if (s.kind != 1 || !s.type.is_struct()) {
             return false;
         }
 
-        glslang::TType* fty = nullptr;
-        for (i = 0; i < members.size(); ++i) {
-            auto* p = members[i].type;
-            if (p->isReference()) {
-                p = p->getReferentType();
-            }
-
-            if (p->getFieldName() == field.stype->lex.string->c_str()) {
-                fty = p;
-                break;
-            }
-        }
-
-        if (!fty) {
+        ChainType fty;
+        if (!s.type.field(field.stype->lex.string->c_str(), fty)) {
             return false;
         }
 
-        if (fty->isArray()) {
+        if (fty.array_dims() > 0) {
             kind = 2;
-        } else if (fty->isStruct()) {
+        } else if (fty.is_struct() || fty.is_vector()) {
             kind = 1;
-        } else if (fty->isScalar()) {
+        } else {
             kind = 3;
         }
 
@@ -429,33 +631,21 @@ private:
             return false;
         }
 
-        auto* ttype = top.ttype;
-        auto sizes = ttype->getArraySizes();
-        if (top.reduce_n_ >= sizes->getNumDims()) {
+        auto dims = top.type.array_dims();
+        if (top.reduce_n_ >= dims) {
             return false;
         }
 
         top.reduce_n_ += 1;
 
-        if (top.reduce_n_ == sizes->getNumDims()) {
-            if (top.ttype->isStruct()) {
+        if (top.reduce_n_ == dims) {
+            if (top.type.is_struct()) {
                 top.kind = 1;
             } else {
                 top.kind = 3;
             }
         }
 
-#if 0
-    if (node->isArray()) {
-        top.kind = 2;
-    } else if (node->isStruct()) {
-        top.kind = 1;
-    } else {
-        top.kind = 3;
-    }
-
-    top.ttype = &node->getType();
-#endif
         return true;
     }
 
@@ -470,23 +660,13 @@ private:
             return false;
         }
 
-        auto* func = doc_.lookup_func_by_line(line_);
-        auto* sym = doc_.lookup_symbol_by_name(func, top.stype->lex.string->c_str());
-        if (!sym) {
-            return false;
-        }
-
-        const auto* type = &sym->getType();
-        if (type->isReference()) {
-            type = type->getReferentType();
-        }
-
-        if (!type->isArray()) {
+        ChainType type;
+        if (!variable_type_(top.stype->lex.string->c_str(), type) || type.array_dims() == 0) {
             return false;
         }
 
         top.kind = 2;
-        top.ttype = type;
+        top.type = type;
         return true;
     }
 
@@ -507,36 +687,17 @@ private:
             return false;
         }
 
-        const glslang::TType* type = nullptr;
-        auto* func = doc_.lookup_func_by_line(line_);
-        auto* sym = doc_.lookup_symbol_by_name(func, top.stype->lex.string->c_str());
-        auto* global = doc_.lookup_symbol_by_name(nullptr, top.stype->lex.string->c_str());
-        auto builtin = doc_.lookup_builtin_symbols_by_prefix(top.stype->lex.string->c_str(), true);
-
-        if (sym) {
-            type = &sym->getType();
-        } else if (global) {
-            type = &global->getType();
-        } else if (!builtin.empty()) {
-            auto* sym = builtin.front();
-            if (auto* var = sym->getAsVariable()) {
-                type = &var->getType();
-            }
-        }
-
-        if (!type)
+        ChainType type;
+        if (!variable_type_(top.stype->lex.string->c_str(), type)) {
             return false;
-
-        if (type->isReference()) {
-            type = type->getReferentType();
         }
 
-        if (!type->isStruct() && !type->isVector()) {
+        if (!type.is_struct() && !type.is_vector()) {
             return false;
         }
 
         top.kind = 1;
-        top.ttype = type;
+        top.type = type;
         return true;
     }
 
@@ -550,195 +711,240 @@ private:
 
     void do_complete_keywords_prefix_(std::string const& prefix, CompletionResultSet& result)
     {
-        for (auto& keyword : keywrods_) {
-            if (match_prefix(keyword, prefix)) {
-                result.keywords.push_back(
-                    {keyword, CompletionItemKind::Keyword, "", "", keyword, InsertTextFormat::PlainText});
-            }
+        for (auto const& [name, item] : keywords_.lookup(prefix)) {
+            result.keywords.push_back(item);
         }
     }
 
     void do_complete_type_prefix_(std::string const& prefix, CompletionResultSet& results)
     {
-        auto const& userdef_types = doc_.userdef_types();
-        for (auto* sym : userdef_types) {
-            auto loc = sym->getLoc();
-            auto const& ty = sym->getType();
-            auto const* tyname = ty.getTypeName().c_str();
-            if (!match_prefix(tyname, prefix))
-                continue;
-
-            CompletionResult r = {
-                tyname, CompletionItemKind::Struct, ty.getCompleteString(true, false, false).c_str(), "",
-                tyname, InsertTextFormat::PlainText};
-            results.types.push_back(r);
-        }
-
-        auto func = doc_.lookup_func_by_line(line_);
-        if (!func) {
-            return;
-        }
-
-        for (auto* sym : func->userdef_types) {
-            auto loc = sym->getLoc();
-
-            auto const& ty = sym->getType();
-            auto const* tyname = ty.getTypeName().c_str();
-            if (!match_prefix(tyname, prefix))
-                continue;
+        auto add_types = [this, &results](DocIR::NameRange const& types) {
+            for (auto const& [name, s] : types) {
+                results.types.push_back(
+                    typed_item(std::string(name), CompletionItemKind::Struct, ir_.structs()[s].type));
+            }
+        };
 
-            CompletionResult r = {
-                tyname, CompletionItemKind::Struct, ty.getCompleteString(true, false, false).c_str(), "",
-                tyname, InsertTextFormat::PlainText};
-            results.types.push_back(r);
+        add_types(ir_.types_by_prefix(DocIR::kNone, prefix));
+        auto func = ir_.function_at(line_);
+        if (func != DocIR::kNone) {
+            add_types(ir_.types_by_prefix(func, prefix));
         }
     }
 
     void do_complete_builtin_prefix_(std::string const& prefix, CompletionResultSet& results)
     {
-        auto builtins = doc_.lookup_builtin_symbols_by_prefix(prefix);
-
-        for (auto* sym : builtins) {
-            if (auto* var = sym->getAsVariable()) {
-                auto* label = var->getName().c_str();
-                std::string detail = var->getType().getCompleteString(true).c_str();
-                CompletionResult result = {label, CompletionItemKind::Variable, detail, "",
-                                           label, InsertTextFormat::PlainText};
-                results.builtins.push_back(result);
-            } else if (const auto* func = sym->getAsFunction()) {
-                std::string func_name = func->getName().c_str();
-                std::string return_type;
-                if (func->getType().isStruct()) {
-                    return_type = func->getType().getTypeName().c_str();
-                } else {
-                    return_type = func->getType().getBasicTypeString().c_str();
-                }
-
-                std::string args_list;
-                std::string args_list_snippet;
-
-                for (int i = 0; i < func->getParamCount(); ++i) {
-                    const auto& arg = (*func)[i];
-                    char buf[128];
-                    auto const& arg_type = *arg.type;
-                    const char* arg_type_str;
-                    if (arg_type.isStruct()) {
-                        arg_type_str = arg_type.getTypeName().c_str();
-                    } else if (arg_type.isVector()) {
-                        arg_type_str = arg_type.getCompleteString(true, false, false).c_str();
-                    } else {
-                        arg_type_str = arg_type.getBasicTypeString().c_str();
-                    }
-
-                    snprintf(buf, sizeof(buf), "${%d:%s %s}", i + 1, arg_type_str, arg.name ? arg.name->c_str() : "");
-
-                    args_list_snippet += buf;
-                    args_list_snippet += ", ";
-                    args_list = args_list + arg_type_str + " " + (arg.name ? arg.name->c_str() : "") + ", ";
-                }
-
-                if (args_list_snippet.size() > 2) {
-                    args_list_snippet.pop_back();
-                    args_list_snippet.pop_back();
-                    args_list.pop_back();
-                    args_list.pop_back();
-                }
-                std::string detail = return_type + " " + func_name + "(" + args_list + ")";
-                std::string insert_text = func_name + "(" + args_list_snippet + ")";
-
-                std::cerr << "complete builtin func: " << insert_text << std::endl;
+        for (auto const& [name, item] : builtins_.lookup(prefix)) {
+            results.builtins.push_back(item);
+        }
+    }
 
-                CompletionResult r = {func_name,   CompletionItemKind::Function, detail, "",
-                                      insert_text, InsertTextFormat::Snippet};
-                results.builtins.push_back(r);
+    void do_complete_extention_prefix_(std::string const& prefix, CompletionResultSet& results)
+    {
+        for (auto e : extentions_) {
+            if (match_prefix(e, prefix)) {
+                results.builtins.push_back(
+                    make_completion_item({e, CompletionItemKind::Text, "", "", e, InsertTextFormat::PlainText}));
             }
         }
     }
+};
 
-    void do_complete_struct_field_(const glslang::TType* ttype, std::string const& prefix, CompletionResultSet& results)
-    {
-        auto match_prefix = [&prefix](std::string const& field) {
-            if (prefix.empty())
-                return true;
+static bool is_ident_char(char c) { return isalnum(static_cast<unsigned char>(c)) || c == '_'; }
 
-            return prefix == field.substr(0, prefix.size());
-        };
+CompletionContext analyze_completion_context(std::string const& text, const int col)
+{
+    CompletionContext context;
+    const int end = std::min<int>(std::max(col, 0), text.size());
+    int i = end;
+    while (i > 0 && is_ident_char(text[i - 1])) {
+        --i;
+    }
+    context.prefix = text.substr(i, end - i);
+    context.start = i;
+
+    size_t first = text.find_first_not_of(" \t");
+    if (first != std::string::npos && static_cast<int>(first) < i && text[first] == '#') {
+        size_t name = text.find_first_not_of(" \t", first + 1);
+        if (name == std::string::npos || name >= static_cast<size_t>(i)) {
+            context.kind = CompletionContext::Kind::DIRECTIVE;
+            return context;
+        }
 
-        auto& members = *ttype->getStruct();
-        for (int i = 0; i < members.size(); ++i) {
-            auto field = members[i].type;
-            auto label = field->getFieldName().c_str();
-            auto kind = CompletionItemKind::Field;
-            auto detail = field->getCompleteString(true, false, false);
-            auto doc = "";
-            if (match_prefix(label)) {
-                results.variables.push_back({label, kind, detail.c_str(), doc, label, InsertTextFormat::PlainText});
-            }
+        size_t name_end = name;
+        while (name_end < text.size() && is_ident_char(text[name_end])) {
+            ++name_end;
         }
+        context.kind = CompletionContext::Kind::PREPROCESSOR;
+        context.expression = text.substr(name, name_end - name);
+        return context;
     }
 
-    void do_complete_extention_prefix_(std::string const& prefix, CompletionResultSet& results)
-    {
-        for (auto e : extentions_) {
-            if (match_prefix(e, prefix)) {
-                results.builtins.push_back({e, CompletionItemKind::Text, "", "", e, InsertTextFormat::PlainText});
+    if (i == 0 || text[i - 1] != '.') {
+        context.kind = CompletionContext::Kind::IDENTIFIER;
+        return context;
+    }
+
+    // walk the access chain back: (identifier ([...])* .)+
+    int j = i;
+    while (j > 0 && text[j - 1] == '.') {
+        --j;
+        while (j > 0 && text[j - 1] == ']') {
+            int depth = 0;
+            do {
+                --j;
+                if (text[j] == ']')
+                    ++depth;
+                else if (text[j] == '[')
+                    --depth;
+            } while (j > 0 && depth > 0);
+
+            if (depth > 0) {
+                return context;
             }
         }
+
+        int k = j;
+        while (k > 0 && is_ident_char(text[k - 1])) {
+            --k;
+        }
+        if (k == j) {
+            // e.g. a call result, nothing to resolve the type from
+            return context;
+        }
+        j = k;
     }
-};
 
-void completion(Doc& doc, std::string const& anon_prefix, std::string const& input, const int line, const int col,
-                CompletionResultSet& results)
-{
-    auto pool = std::make_unique<glslang::TPoolAllocator>();
-    glslang::SetThreadPoolAllocator(pool.get());
-    const char* source = input.data();
-    size_t len = input.size();
-    glslang::TInputScanner userInput(1, &source, &len);
+    context.kind = CompletionContext::Kind::MEMBER;
+    context.expression = text.substr(j, i - j);
+    return context;
+}
 
-    int version;
-    EProfile profile;
-    EShLanguage stage;
-    glslang::SpvVersion spvVersion;
+struct LanguageInfo {
+    int version = 0;
+    EProfile profile = ENoProfile;
+    EShLanguage stage = EShLangVertex;
+    glslang::SpvVersion spv;
     std::string entrypoint = "main";
-    bool notFirstToken;
-
-    if (auto* interm = doc.intermediate()) {
-        version = interm->getVersion();
-        profile = interm->getProfile();
-        stage = interm->getStage();
-        spvVersion = interm->getSpv();
-        entrypoint = interm->getEntryPointName();
+};
+
+static bool language_info(Doc& doc, LanguageInfo& info)
+{
+    if (auto const* ir = doc.ir()) {
+        info.version = ir->version();
+        info.profile = ir->profile();
+        info.stage = ir->stage();
+        info.spv = ir->spv();
+        info.entrypoint = ir->entrypoint();
     } else {
         const char* text = doc.text();
         if (!text) {
-            return;
+            return false;
         }
 
+        bool notFirstToken;
         size_t len = strlen(text);
         glslang::TInputScanner versionScanner(1, &text, &len);
-        versionScanner.scanVersion(version, profile, notFirstToken);
+        versionScanner.scanVersion(info.version, info.profile, notFirstToken);
+        info.stage = doc.language();
+    }
+
+    return info.version > 0;
+}
+
+// extensions known for a language version, they only depend on it so the parser that lists them
+// is created once per version
+static std::vector<const char*> const& extension_names(LanguageInfo const& info)
+{
+    static std::mutex mutex;
+    static std::map<std::tuple<int, int, int, unsigned, int>, std::vector<std::string>> names;
+    static std::map<std::tuple<int, int, int, unsigned, int>, std::vector<const char*>> views;
+
+    std::lock_guard<std::mutex> lock(mutex);
+    auto key = std::make_tuple(info.version, int(info.profile), int(info.stage), info.spv.spv, info.spv.vulkan);
+    auto pos = views.find(key);
+    if (pos != views.end()) {
+        return pos->second;
     }
 
-    if (version <= 0) {
+    auto* previous = &glslang::GetThreadPoolAllocator();
+    glslang::TPoolAllocator pool;
+    glslang::SetThreadPoolAllocator(&pool);
+    {
+        auto parser_resource = create_parser(info.version, info.profile, info.stage, info.spv, info.entrypoint.c_str());
+        parser_resource->parse_context->initializeExtensionBehavior();
+        auto textensions = parser_resource->parse_context->getExtensionList();
+        auto& list = names[key];
+        list.assign(textensions.cbegin(), textensions.cend());
+    }
+    glslang::SetThreadPoolAllocator(previous);
+
+    auto& view = views[key];
+    for (auto const& name : names[key]) {
+        view.push_back(name.c_str());
+    }
+    return view;
+}
+
+// built-in items only depend on the catalog, every document of a language shares them
+static ItemIndex const& builtin_items(Doc& doc)
+{
+    static std::mutex mutex;
+    static std::map<BuiltinCatalog const*, ItemIndex> cache;
+    static ItemIndex const empty;
+
+    auto* catalog = doc.builtins();
+    if (!catalog) {
+        return empty;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex);
+    auto pos = cache.find(catalog);
+    if (pos != cache.end()) {
+        return pos->second;
+    }
+
+    auto& items = cache[catalog];
+    for (auto const& [name, sym] : catalog->all()) {
+        if (sym->getAsVariable() || sym->getAsFunction()) {
+            add_item(items, builtin_result(sym));
+        }
+    }
+    items.build();
+    return items;
+}
+
+static void complete_context(DocIR const& ir, LanguageInfo const& info, CompletionHelper& helper,
+                             CompletionContext const& context, CompletionResultSet& results)
+{
+    if (context.kind == CompletionContext::Kind::PREPROCESSOR) {
+        if (context.expression == "extension") {
+            helper.do_complete_extension(context.prefix, results);
+        } else {
+            helper.do_complete_identifier(context.prefix, results);
+        }
         return;
     }
 
-    auto parser_resource = create_parser(version, profile, stage, spvVersion, entrypoint.c_str());
+    if (context.kind == CompletionContext::Kind::IDENTIFIER) {
+        if (!context.prefix.empty()) {
+            helper.do_complete_identifier(context.prefix, results);
+        }
+        return;
+    }
+
+    // MEMBER: lex the access chain, the only lexing a request does
+    std::string input = context.expression + context.prefix;
+    const char* source = input.data();
+    size_t len = input.size();
+    glslang::TInputScanner userInput(1, &source, &len);
+
+    auto parser_resource = create_parser(info.version, info.profile, info.stage, info.spv, info.entrypoint.c_str());
     parser_resource->ppcontext->setInput(userInput, false);
     parser_resource->parse_context->setScanner(&userInput);
     parser_resource->parse_context->initializeExtensionBehavior();
-    auto textensions = parser_resource->parse_context->getExtensionList();
-    std::vector<const char*> extentions(textensions.cbegin(), textensions.cend());
 
     std::vector<std::tuple<YYSTYPE, int>> input_toks;
-    if (!anon_prefix.empty()) {
-        YYSTYPE lex;
-        lex.lex.string = glslang::NewPoolTString(anon_prefix.c_str());
-        input_toks.push_back({lex, IDENTIFIER});
-        input_toks.push_back({YYSTYPE{}, DOT});
-    }
-
     while (true) {
         YYSTYPE stype;
         int tok = yylex(&stype, *parser_resource->parse_context);
@@ -749,10 +955,216 @@ void completion(Doc& doc, std::string const& anon_prefix, std::string const& inp
         input_toks.push_back(std::make_tuple(stype, tok));
     }
 
-    if (input_toks.empty())
+    if (input_toks.empty()) {
         return;
+    }
 
     input_toks.push_back({YYSTYPE{}, -1});
-    CompletionHelper helper(doc, line, col, __keywords, extentions);
     helper.do_complete(input_toks, results);
+
+    // the head of the chain may be a member of an anonymous block, resolve it through the block
+    auto const& [head, head_tok] = input_toks.front();
+    if (head_tok != IDENTIFIER) {
+        return;
+    }
+
+    for (auto const& [name, block] : ir.globals_by_prefix("anon@")) {
+        auto const& shape = ir.symbols()[block].shape;
+        if (shape.struct_index == DocIR::kNone) {
+            continue;
+        }
+
+        auto const& s = ir.structs()[shape.struct_index];
+        auto first = ir.fields().begin() + s.first_field;
+        bool has_member = std::any_of(first, first + s.field_count, [&ir, &head](DocIR::Field const& f) {
+            return ir.str(f.name) == head.lex.string->c_str();
+        });
+        if (!has_member) {
+            continue;
+        }
+
+        std::vector<std::tuple<YYSTYPE, int>> block_toks;
+        YYSTYPE lex;
+        lex.lex.string = glslang::NewPoolTString(std::string(name).c_str());
+        block_toks.push_back({lex, IDENTIFIER});
+        block_toks.push_back({YYSTYPE{}, DOT});
+        block_toks.insert(block_toks.end(), input_toks.begin(), input_toks.end());
+        helper.do_complete(block_toks, results);
+    }
+}
+
+static std::vector<const char*> const kDirectives = {"define", "undef",  "if",   "ifdef",     "ifndef",
+                                                     "else",   "elif",   "endif", "error",    "pragma",
+                                                     "extension", "version", "line", "include"};
+
+void completion(Doc& doc, CompletionContext const& context, const int line, CompletionResultSet& results)
+{
+    if (context.kind == CompletionContext::Kind::NONE) {
+        return;
+    }
+
+    if (context.kind == CompletionContext::Kind::DIRECTIVE) {
+        for (auto* directive : kDirectives) {
+            if (strncmp(directive, context.prefix.c_str(), context.prefix.size()) == 0) {
+                results.keywords.push_back(make_completion_item(
+                    {directive, CompletionItemKind::Keyword, "", "", directive, InsertTextFormat::PlainText}));
+            }
+        }
+        return;
+    }
+
+    LanguageInfo info;
+    if (!language_info(doc, info)) {
+        return;
+    }
+
+    // the lexer allocates from the pool, the cached items copy what they keep
+    static const DocIR unparsed{};
+    auto const& ir = doc.ir() ? *doc.ir() : unparsed;
+    auto* previous = &glslang::GetThreadPoolAllocator();
+    glslang::TPoolAllocator pool;
+    glslang::SetThreadPoolAllocator(&pool);
+    {
+        auto funcs = function_items(doc);
+        CompletionHelper helper(ir, doc.builtins(), line, context.start, keyword_items(), builtin_items(doc), *funcs,
+                                extension_names(info));
+        complete_context(ir, info, helper, context, results);
+    }
+    glslang::SetThreadPoolAllocator(previous);
+}
+
+bool CompletionRanker::can_narrow(std::string const& uri, const int line, const int start,
+                                  std::string const& word) const
+{
+    return !word_.empty() && word.size() > word_.size() && uri == uri_ && line == line_ && start == start_ &&
+           word.compare(0, word_.size(), word_) == 0;
+}
+
+CompletionRanker::Result CompletionRanker::narrow(std::string const& word) { return select_(word); }
+
+CompletionRanker::Result CompletionRanker::rank(Doc const& doc, const int line, const int start,
+                                                std::string const& word, CompletionResultSet& candidates)
+{
+    // the types of the items are strings of its IR
+    ir_ = doc.shared_ir();
+    uri_ = doc.uri();
+    line_ = line;
+    start_ = start;
+    word_.clear();
+    matches_.clear();
+
+    int category = 0;
+    for (auto* group : {&candidates.variables, &candidates.funcs, &candidates.types, &candidates.keywords,
+                        &candidates.builtins}) {
+        std::unordered_set<std::string> seen;
+        for (auto& item : *group) {
+            if (seen.insert(item->result.insert_text).second) {
+                matches_.emplace_back(category, std::move(item));
+            }
+        }
+        ++category;
+    }
+
+    return select_(word);
+}
+
+CompletionRanker::Result CompletionRanker::select_(std::string const& word)
+{
+    FuzzyMatcher matcher(word);
+    TopK top(kMaxItems);
+    std::vector<std::pair<int, CompletionItemPtr>> matched;
+    for (auto& match : matches_) {
+        int score = matcher.score(match.second->result.label);
+        if (score < 0) {
+            continue;
+        }
+
+        uint64_t key = (uint64_t(match.first) << 32) | matched.size();
+        top.push({score, key, matched.size()});
+        matched.push_back(std::move(match));
+    }
+
+    // a longer word only matches a subset of these
+    matches_.swap(matched);
+    word_ = word;
+
+    Result result;
+    result.id = ++response_id_;
+    result.incomplete = matches_.size() > kMaxItems;
+    auto best = top.take();
+    result.items.reserve(best.size());
+    for (auto const& entry : best) {
+        result.items.push_back(matches_[entry.index].second);
+    }
+    served_ = result.items;
+
+    return result;
+}
+
+nlohmann::json CompletionRanker::Result::json(bool resolve_insert_text) const
+{
+    nlohmann::json list = nlohmann::json::array();
+    for (size_t i = 0; i < items.size(); ++i) {
+        auto const& result = items[i]->result;
+        // the items are ranked already, the client keeps the order and matches against the label
+        char sort_text[24];
+        snprintf(sort_text, sizeof(sort_text), "%04zu", i);
+        nlohmann::json json = {
+            {"label", result.label},
+            {"kind", int(result.kind)},
+            {"sortText", sort_text},
+            {"filterText", result.label},
+            {"data", id * kMaxItems + i},
+        };
+        if (!resolve_insert_text) {
+            json["insertText"] = result.insert_text;
+            json["insertTextFormat"] = result.insert_text_format;
+        }
+        list.push_back(std::move(json));
+    }
+
+    return {{"isIncomplete", incomplete}, {"items", std::move(list)}};
+}
+
+void CompletionRanker::forget(std::string const& uri)
+{
+    if (uri != uri_) {
+        return;
+    }
+
+    // response_id_ is kept, items of the forgotten response must not resolve against a later one
+    ir_.reset();
+    uri_.clear();
+    line_ = -1;
+    start_ = -1;
+    word_.clear();
+    matches_.clear();
+    served_.clear();
+}
+
+nlohmann::json CompletionRanker::resolve(nlohmann::json const& item) const
+{
+    if (!item.contains("data") || !item["data"].is_number_integer()) {
+        return item;
+    }
+
+    // data comes from the client, a negative one would index before served_
+    int64_t data = item["data"];
+    if (data < 0 || data / int64_t(kMaxItems) != response_id_ || data % int64_t(kMaxItems) >= int64_t(served_.size())) {
+        // not from the last response, the client moved on
+        return item;
+    }
+
+    auto const& served = *served_[data % int64_t(kMaxItems)];
+    nlohmann::json resolved = served.json.is_null() ? served.result.json() : served.json;
+    if (served.type && ir_) {
+        resolved["detail"] = ir_->str(served.type);
+    }
+
+    for (auto const* key : {"sortText", "filterText", "data"}) {
+        if (item.contains(key)) {
+            resolved[key] = item[key];
+        }
+    }
+    return resolved;
 }
@@ -3,7 +3,81 @@
 
 #include "doc.hpp"
 #include "lsp_defs.hpp"
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
 
-extern void completion(Doc& doc, std::string const& anon_prefix, std::string const& input, const int line,
-                       const int col, CompletionResultSet& results);
+// every keyword of the language, type names included
+extern std::vector<const char*> __keywords;
+
+// what is being completed, found by one backward scan of the line from the cursor
+struct CompletionContext {
+    enum class Kind {
+        NONE,
+        // a bare identifier
+        IDENTIFIER,
+        // a member of an access chain like a.b[i].c
+        MEMBER,
+        // the name of a preprocessor directive after #
+        DIRECTIVE,
+        // an argument of a preprocessor directive
+        PREPROCESSOR,
+    } kind = Kind::NONE;
+    // MEMBER: the chain up to and including the last '.'. PREPROCESSOR: the directive name
+    std::string expression;
+    // identifier typed before the cursor
+    std::string prefix;
+    // column the prefix starts at
+    int start = 0;
+};
+
+extern CompletionContext analyze_completion_context(std::string const& text, const int col);
+// line is 1-based like the AST, only the first lexes, and only the access chain of a MEMBER context
+extern void completion(Doc& doc, CompletionContext const& context, const int line, CompletionResultSet& results);
+// drop the items cached for the document at uri, once it is closed
+extern void forget_completion_items(std::string const& uri);
+
+// ranks completion candidates against the identifier typed before the cursor and keeps the best
+// kMaxItems. the matches of the last request are kept, so typing more of the same identifier only
+// rescores them instead of collecting candidates again.
+class CompletionRanker {
+public:
+    static constexpr size_t kMaxItems = 200;
+
+    struct Result {
+        // items are referred to by id * kMaxItems + index in completionItem/resolve
+        int64_t id = 0;
+        std::vector<CompletionItemPtr> items;
+        // more items matched than were returned, the client has to ask again as the user types
+        bool incomplete = false;
+
+        // the CompletionList of the response, detail and documentation are left to resolve, and so are
+        // snippets when the client can resolve insertText
+        nlohmann::json json(bool resolve_insert_text) const;
+    };
+
+    bool can_narrow(std::string const& uri, const int line, const int start, std::string const& word) const;
+    Result narrow(std::string const& word);
+    Result rank(Doc const& doc, const int line, const int start, std::string const& word,
+                CompletionResultSet& candidates);
+    // complete an item of the last response
+    nlohmann::json resolve(nlohmann::json const& item) const;
+    // let go of the document at uri if the last response was for it
+    void forget(std::string const& uri);
+
+private:
+    // the IR the types of the items are strings of
+    std::shared_ptr<const DocIR> ir_;
+    std::string uri_;
+    int line_ = -1;
+    int start_ = -1;
+    std::string word_;
+    // candidates matching word_ and their category, lower categories are listed first on equal scores
+    std::vector<std::pair<int, CompletionItemPtr>> matches_;
+    int64_t response_id_ = 0;
+    std::vector<CompletionItemPtr> served_;
+
+    Result select_(std::string const& word);
+};
 #endif
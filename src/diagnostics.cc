@@ -0,0 +1,181 @@
+#include "diagnostics.hpp"
+#include "doc.hpp"
+#include <cctype>
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+#include <string_view>
+
+static bool is_number(std::string_view s)
+{
+    if (s.empty())
+        return false;
+
+    for (char c : s) {
+        if (!isdigit(static_cast<unsigned char>(c)))
+            return false;
+    }
+    return true;
+}
+
+// strip a trailing ":<number>" off loc
+static bool take_number(std::string_view& loc, int& value)
+{
+    auto colon = loc.rfind(':');
+    if (colon == std::string_view::npos || !is_number(loc.substr(colon + 1))) {
+        return false;
+    }
+
+    value = atoi(std::string(loc.substr(colon + 1)).c_str());
+    loc = loc.substr(0, colon);
+    return true;
+}
+
+static bool parse_line(std::string_view line, std::string const& uri, Diagnostic& diagnostic)
+{
+    static const struct {
+        std::string_view prefix;
+        DiagnosticSeverity severity;
+    } kPrefixes[] = {
+        {"ERROR: ", DiagnosticSeverity::Error},         {"INTERNAL ERROR: ", DiagnosticSeverity::Error},
+        {"UNIMPLEMENTED: ", DiagnosticSeverity::Error}, {"WARNING: ", DiagnosticSeverity::Warning},
+        {"NOTE: ", DiagnosticSeverity::Information},
+    };
+
+    bool matched = false;
+    for (auto const& [prefix, severity] : kPrefixes) {
+        if (line.compare(0, prefix.size(), prefix) == 0) {
+            line.remove_prefix(prefix.size());
+            diagnostic.severity = severity;
+            matched = true;
+            break;
+        }
+    }
+
+    // "ERROR: 1 compilation errors.  No code generated." has no location
+    auto sep = line.find(": ");
+    if (!matched || sep == std::string_view::npos) {
+        return false;
+    }
+
+    std::string_view loc = line.substr(0, sep);
+    std::string_view message = line.substr(sep + 2);
+    int line_number = 0;
+    int column = 0;
+    if (!take_number(loc, line_number)) {
+        return false;
+    }
+    if (take_number(loc, column)) {
+        std::swap(line_number, column);
+    }
+
+    const std::string_view scheme = "file://";
+    if (loc.empty() || is_number(loc)) {
+        diagnostic.uri = uri;
+    } else if (loc.compare(0, scheme.size(), scheme) == 0) {
+        diagnostic.uri = loc;
+    } else {
+        diagnostic.uri = std::string(scheme) + std::string(loc);
+    }
+
+    while (!message.empty() && (message.back() == ' ' || message.back() == '\r')) {
+        message.remove_suffix(1);
+    }
+    diagnostic.message = message;
+
+    // the token the message is about, "'foo' : reason", gives the range its length
+    int length = 0;
+    if (!message.empty() && message.front() == '\'') {
+        auto end = message.find("' : ", 1);
+        if (end != std::string_view::npos) {
+            length = end - 1;
+        }
+    }
+
+    int start_line = line_number > 0 ? line_number - 1 : 0;
+    int start_column = column > 0 ? column - 1 : 0;
+    diagnostic.range = {{start_line, start_column}, {start_line, start_column + length}};
+    return true;
+}
+
+std::vector<Diagnostic> parse_info_log(std::string const& log, std::string const& uri)
+{
+    std::vector<Diagnostic> diagnostics;
+    size_t begin = 0;
+    while (begin < log.size()) {
+        size_t end = log.find('\n', begin);
+        if (end == std::string::npos) {
+            end = log.size();
+        }
+
+        Diagnostic diagnostic;
+        if (parse_line(std::string_view(log).substr(begin, end - begin), uri, diagnostic)) {
+            diagnostics.push_back(std::move(diagnostic));
+        }
+        begin = end + 1;
+    }
+
+    return diagnostics;
+}
+
+std::string diagnostics_result_id(Doc const& doc)
+{
+    char id[24];
+    snprintf(id, sizeof(id), "%016llx", static_cast<unsigned long long>(doc.diagnostics_key()));
+    return id;
+}
+
+// the diagnostics of doc grouped by file, the document itself always has an entry
+static std::map<std::string, nlohmann::json> group_by_uri(Doc const& doc)
+{
+    std::map<std::string, nlohmann::json> by_uri = {{doc.uri(), nlohmann::json::array()}};
+    for (auto const& diagnostic : doc.diagnostics()) {
+        auto& list = by_uri[diagnostic.uri];
+        if (list.is_null()) {
+            list = nlohmann::json::array();
+        }
+        list.push_back(diagnostic.json());
+    }
+    return by_uri;
+}
+
+nlohmann::json document_diagnostic_report(Doc const& doc, std::string const& previous_result_id)
+{
+    auto result_id = diagnostics_result_id(doc);
+    if (result_id == previous_result_id) {
+        return {{"kind", "unchanged"}, {"resultId", result_id}};
+    }
+
+    auto by_uri = group_by_uri(doc);
+    nlohmann::json report = {{"kind", "full"}, {"resultId", result_id}, {"items", std::move(by_uri[doc.uri()])}};
+    nlohmann::json related = nlohmann::json::object();
+    for (auto& [uri, items] : by_uri) {
+        if (uri != doc.uri()) {
+            related[uri] = {{"kind", "full"}, {"items", std::move(items)}};
+        }
+    }
+    if (!related.empty()) {
+        report["relatedDocuments"] = std::move(related);
+    }
+    return report;
+}
+
+nlohmann::json workspace_diagnostic_report(Doc const& doc, std::string const& previous_result_id)
+{
+    auto result_id = diagnostics_result_id(doc);
+    nlohmann::json report = {{"uri", doc.uri()}, {"version", doc.version()}, {"resultId", result_id}};
+    if (result_id == previous_result_id) {
+        report["kind"] = "unchanged";
+        return report;
+    }
+
+    nlohmann::json items = nlohmann::json::array();
+    for (auto const& diagnostic : doc.diagnostics()) {
+        if (diagnostic.uri == doc.uri()) {
+            items.push_back(diagnostic.json());
+        }
+    }
+    report["kind"] = "full";
+    report["items"] = std::move(items);
+    return report;
+}
@@ -0,0 +1,22 @@
+#ifndef __GLSLX_DIAGNOSTICS_HPP__
+#define __GLSLX_DIAGNOSTICS_HPP__
+#include "lsp_defs.hpp"
+#include "nlohmann/json.hpp"
+#include <string>
+#include <vector>
+
+class Doc;
+
+// the messages of a glslang info log, parsed once when a document is parsed. glslang only reports
+// through the log, lines look like "ERROR: file:///a.glsl:12:5: 'foo' : undeclared identifier" with
+// EShMsgDisplayErrorColumn. locations without a file name belong to uri, header paths become uris.
+extern std::vector<Diagnostic> parse_info_log(std::string const& log, std::string const& uri);
+
+// resultId of the diagnostics of doc, see Doc::diagnostics_key
+extern std::string diagnostics_result_id(Doc const& doc);
+// a full DocumentDiagnosticReport, diagnostics of headers go into relatedDocuments. nothing is
+// serialized if the client already has previous_result_id, the report is unchanged then.
+extern nlohmann::json document_diagnostic_report(Doc const& doc, std::string const& previous_result_id);
+// the same for one item of a WorkspaceDiagnosticReport, without related documents
+extern nlohmann::json workspace_diagnostic_report(Doc const& doc, std::string const& previous_result_id);
+#endif
@@ -1,12 +1,17 @@
 #include "doc.hpp"
 #include "StandAlone/DirStackFileIncluder.h"
 #include "args.hpp"
+#include "diagnostics.hpp"
 #include "extractors.hpp"
 #include "glslang/Include/intermediate.h"
 #include "glslang/MachineIndependent/SymbolTable.h"
 #include "glslang/MachineIndependent/localintermediate.h"
+#include "include_cache.hpp"
 #include "parser.hpp"
+#include "preprocess.hpp"
+#include "stats.hpp"
 #include <algorithm>
+#include <atomic>
 #include <cstdio>
 #include <map>
 #include <memory>
@@ -14,8 +19,6 @@
 #include <utility>
 #include <vector>
 
-extern int yylex(YYSTYPE*, glslang::TParseContext&);
-
 Doc::Doc() { resource_ = nullptr; }
 
 Doc::~Doc() { release_(); }
@@ -28,43 +31,123 @@ Doc::Doc(std::string const& uri, const int version, std::string const& text, Com
     resource_->uri = uri;
     resource_->version = version;
 
-    set_text(text);
+    // the preprocessor pass needs the language
     infer_language_();
-    resource_->shader = nullptr;
+    set_text(text);
+    compute_inactive_blocks_();
+}
+
+// split on '\n' only, so joining the lines with '\n' gives back the original text.
+static void split_lines(std::string const& text, std::vector<std::string>& lines)
+{
+    size_t start = 0;
+    while (true) {
+        auto pos = text.find('\n', start);
+        if (pos == std::string::npos) {
+            lines.emplace_back(text, start);
+            break;
+        }
+
+        lines.emplace_back(text, start, pos - start);
+        start = pos + 1;
+    }
 }
 
 void Doc::set_text(std::string const& text)
 {
     if (!resource_)
         return;
-    std::stringstream ss(text);
-    std::string line;
 
     resource_->lines_.clear();
-    while (std::getline(ss, line)) {
-        resource_->lines_.emplace_back(std::move(line));
-    }
+    split_lines(text, resource_->lines_);
 
     resource_->text_ = text;
-    compute_inactive_blocks_();
+    resource_->text_dirty_ = false;
 }
 
-Doc::Doc(const Doc& rhs)
+void Doc::update(const int version, std::vector<TextDocumentContentChangeEvent> const& changes,
+                 PositionEncoding encoding)
 {
-    release_();
-    resource_ = rhs.resource_;
-    resource_->ref += 1;
-    option_ = rhs.option_;
+    if (!resource_ || resource_->version >= version)
+        return;
+
+    resource_->version = version;
+    for (auto const& change : changes) {
+        if (!change.has_range) {
+            resource_->lines_.clear();
+            split_lines(change.text, resource_->lines_);
+        } else {
+            apply_change_(change.range, change.text, encoding);
+        }
+    }
+
+    resource_->text_dirty_ = true;
 }
 
-Doc::Doc(Doc&& rhs)
+void Doc::apply_change_(::Range const& range, std::string const& text, PositionEncoding encoding)
 {
-    release_();
-    resource_ = rhs.resource_;
-    rhs.resource_ = nullptr;
-    option_ = rhs.option_;
+    auto& lines = resource_->lines_;
+    if (lines.empty()) {
+        lines.emplace_back();
+    }
+
+    const int last_line = (int)lines.size() - 1;
+    const int start_line = std::clamp(range.start.line, 0, last_line);
+    const int end_line = std::clamp(range.end.line, start_line, last_line);
+    const int start_col = utf8_column(lines[start_line], range.start.character, encoding);
+    const int end_col = utf8_column(lines[end_line], range.end.character, encoding);
+
+    std::vector<std::string> replacement;
+    split_lines(text, replacement);
+    replacement.front().insert(0, lines[start_line], 0, start_col);
+    replacement.back().append(lines[end_line], end_col, std::string::npos);
+
+    const size_t replaced = end_line - start_line + 1;
+    auto first = lines.begin() + start_line;
+    const size_t common = std::min(replaced, replacement.size());
+    std::move(replacement.begin(), replacement.begin() + common, first);
+
+    if (replaced > replacement.size()) {
+        lines.erase(first + common, first + replaced);
+    } else if (replaced < replacement.size()) {
+        lines.insert(first + common, std::make_move_iterator(replacement.begin() + common),
+                     std::make_move_iterator(replacement.end()));
+    }
 }
 
+std::string const& Doc::materialize_text_()
+{
+    if (!resource_->text_dirty_) {
+        return resource_->text_;
+    }
+
+    size_t size = 0;
+    for (auto const& line : resource_->lines_) {
+        size += line.size() + 1;
+    }
+
+    auto& text = resource_->text_;
+    text.clear();
+    text.reserve(size);
+    for (size_t i = 0; i < resource_->lines_.size(); ++i) {
+        if (i > 0) {
+            text.push_back('\n');
+        }
+        text.append(resource_->lines_[i]);
+    }
+
+    resource_->text_dirty_ = false;
+    return text;
+}
+
+Doc::Doc(const Doc& rhs) : option_(rhs.option_), resource_(rhs.resource_)
+{
+    if (resource_)
+        resource_->ref += 1;
+}
+
+Doc::Doc(Doc&& rhs) : option_(rhs.option_), resource_(rhs.resource_) { rhs.resource_ = nullptr; }
+
 Doc& Doc::operator=(const Doc& rhs)
 {
     release_();
@@ -110,25 +193,6 @@ void Doc::release_()
     }
 }
 
-class BuiltinSymbolTable : public glslang::TSymbolTable {
-public:
-    void get_all_symbols(std::vector<glslang::TSymbol*>& symbols)
-    {
-        for (int level = currentLevel(); level >= 0; --level) {
-            glslang::TSymbolTableLevel* table_level = table[level];
-            for (auto pos = table_level->get_level().begin(); pos != table_level->get_level().end(); ++pos) {
-                symbols.push_back(pos->second);
-                if (auto var = pos->second->getAsVariable()) {
-                    auto loc = var->getLoc();
-                    const auto& type = var->getType();
-                    if (loc.name && type.isStruct()) {
-                    }
-                }
-            }
-        }
-    }
-};
-
 std::unique_ptr<glslang::TShader> Doc::create_shader()
 {
     CompileOption compile_option = option_;
@@ -167,7 +231,7 @@ std::unique_ptr<glslang::TShader> Doc::create_shader()
     shader.setInvertY(compile_option.invert_y);
     shader.setNanMinMaxClamp(false);
 
-    auto& shader_strings = resource_->text_;
+    auto& shader_strings = materialize_text_();
     const char* shader_source = shader_strings.data();
     const int shader_lengths = (int)shader_strings.size();
     const char* string_names = resource_->uri.data();
@@ -181,52 +245,56 @@ bool Doc::parse()
     if (!resource_)
         return false;
 
-    auto* resource = new Doc::__Resource;
-    resource->shader = create_shader();
-
-    resource->nodes_by_line.clear();
-    resource->globals.clear();
-    resource->func_defs.clear();
-    resource->userdef_types.clear();
-    resource->builtins.clear();
-
-    auto& shader = *resource->shader;
-
-    std::string preambles;
-    for (auto const& [k, v] : option_.macros) {
-        preambles.append("#define " + k + " " + v + "\n");
+    // the AST lives in the pool of the shader, it is freed with it once the IR is extracted
+    auto p = create_shader();
+    if (!p) {
+        return false;
     }
 
-    const std::string pound_extension = "#extension GL_GOOGLE_include_directive : enable\n";
-    preambles += pound_extension;
+    auto diagnostics_key = diagnostics_key_();
+    auto& shader = *p;
 
+    auto preambles = preamble_();
     shader.setPreamble(preambles.c_str());
     shader.setDebugInfo(true);
 
-    BuiltinSymbolTable builtin_symbol_table;
-    shader.setBuiltinSymbolTable(&builtin_symbol_table);
-
-    DirStackFileIncluder includer;
+    CachedFileIncluder includer;
     for (auto& d : option_.include_dirs) {
         includer.pushExternalLocalDirectory(d);
     }
 
-    const EShMessages rules = static_cast<EShMessages>(EShMsgCascadingErrors | EShMsgSpvRules | EShMsgVulkanRules);
+    // columns make the diagnostics point at the token instead of the line
+    const EShMessages rules = static_cast<EShMessages>(EShMsgCascadingErrors | EShMsgSpvRules | EShMsgVulkanRules |
+                                                       EShMsgDisplayErrorColumn);
     auto default_version_ = option_.version;
     auto default_profile_ = option_.profile;
     auto force_version_profile_ = false;
 
-    bool success = false;
+    static auto& parse_time = Stats::get().phase("parse");
+    static auto& extract_time = Stats::get().phase("extract");
+    static auto& parses = Stats::get().counter("parses");
+    static auto& parse_failures = Stats::get().counter("parseFailures");
 
-    success = shader.parse(&kDefaultTBuiltInResource, default_version_, default_profile_, force_version_profile_, false,
-                           rules, includer);
+    bool success = false;
+    {
+        ScopedTimer timer(parse_time);
+        success = shader.parse(&kDefaultTBuiltInResource, default_version_, default_profile_, force_version_profile_,
+                               false, rules, includer);
+    }
+    parses.fetch_add(1, std::memory_order_relaxed);
     if (!success) {
+        parse_failures.fetch_add(1, std::memory_order_relaxed);
         resource_->info_log = shader.getInfoLog();
-        delete resource;
+        resource_->diagnostics = parse_info_log(resource_->info_log, resource_->uri);
+        resource_->diagnostics_key = diagnostics_key;
         return false;
     }
 
-    fprintf(stderr, "%s\n", shader.getInfoDebugLog());
+    auto* resource = new Doc::__Resource;
+    resource->info_log = shader.getInfoLog();
+    resource->diagnostics = parse_info_log(resource->info_log, resource_->uri);
+    resource->diagnostics_key = diagnostics_key;
+
     auto* interm = shader.getIntermediate();
 
 #if 0
@@ -238,111 +306,115 @@ bool Doc::parse()
     }
 #endif
 
-    DocInfoExtractor visitor;
-    interm->getTreeRoot()->traverse(&visitor);
-
-    for (auto& s : visitor.globals) {
-        auto loc = s->getLoc();
-        fprintf(stderr, "global symbol %s define at %s:%d:%d\n", s->getName().c_str(), loc.getFilename(), loc.line,
-                loc.column);
-        resource->globals.push_back(s);
-    }
-
-    for (auto& t : visitor.userdef_types) {
-        auto loc = t->getLoc();
-        auto const& type = t->getType();
-        fprintf(stderr, "user def type %s: %s define at %s:%d:%d\n", type.getTypeName().c_str(),
-                type.getCompleteString(true, false, false).c_str(), loc.getFilename(), loc.line, loc.column);
-    }
-
-    fprintf(stderr, "DocInfoExtractor found %zu function def\n", visitor.funcs.size());
-    resource->globals.swap(visitor.globals);
-    resource->func_defs.swap(visitor.funcs);
-    resource->nodes_by_line.swap(visitor.nodes_by_line);
-    resource->userdef_types.swap(visitor.userdef_types);
-    builtin_symbol_table.get_all_symbols(resource->builtins);
-
+    {
+        ScopedTimer timer(extract_time);
+        DocInfoExtractor visitor;
+        interm->getTreeRoot()->traverse(&visitor);
+        auto ir = std::make_shared<DocIR>();
+        ir->build(resource_->uri, *interm, visitor.globals, visitor.funcs, visitor.userdef_types,
+                  visitor.node_positions);
+        resource->ir = std::move(ir);
+        resource->builtins = BuiltinCatalog::get(interm->getVersion(), interm->getProfile(), interm->getStage(),
+                                                 interm->getSpv());
+    }
+
+    static std::atomic<uint64_t> next_parse_id{0};
+    resource->parse_id = ++next_parse_id;
     resource->uri = resource_->uri;
     resource->version = resource_->version;
     resource->text_ = std::move(resource_->text_);
     resource->lines_ = std::move(resource_->lines_);
     resource->language = resource_->language;
+    // the text did not change, neither did its preprocessor pass
+    resource->pp_key = resource_->pp_key;
+    resource->pp = resource_->pp;
+    resource->memory_usage = estimate_memory_usage_(*resource);
 
     release_();
     resource_ = resource;
-	compute_inactive_blocks_();
+    compute_inactive_blocks_();
     return true;
 }
 
-void Doc::tokenize_(CompileOption const& options)
+void Doc::adopt(Doc&& parsed)
 {
-    // tokenize
-    auto default_version_ = options.version;
-    auto default_profile_ = options.profile;
-    auto default_spv = glslang::SpvVersion();
-    auto parser = create_parser(default_version_, default_profile_, language(), default_spv, "main");
-
-    size_t len = resource_->text_.size();
-    const char* shader_source = resource_->text_.data();
-    glslang::TInputScanner scanner(1, &shader_source, &len);
+    if (!parsed.resource_)
+        return;
 
-    parser->ppcontext->setInput(scanner, false);
-    parser->parse_context->setScanner(&scanner);
+    if (!resource_) {
+        *this = std::move(parsed);
+        return;
+    }
 
-    while (true) {
-        YYSTYPE stype;
-        int tok = yylex(&stype, *parser->parse_context);
-        if (!tok) {
-            break;
-        }
+    // keep the newest text, the parsed resource may belong to an older version.
+    auto* resource = parsed.resource_;
+    parsed.resource_ = nullptr;
 
-        auto line = stype.lex.loc.line;
-        resource_->tokens_by_line[line].push_back({tok, stype.lex});
+    // for the same version the parsed preprocessor pass is the fresher one, a header may have changed since.
+    if (resource->version != resource_->version) {
+        resource->inactive_blocks_ = std::move(resource_->inactive_blocks_);
+        resource->pp_key = resource_->pp_key;
+        resource->pp = resource_->pp;
     }
+
+    resource->uri = resource_->uri;
+    resource->version = resource_->version;
+    resource->text_ = std::move(resource_->text_);
+    resource->text_dirty_ = resource_->text_dirty_;
+    resource->lines_ = std::move(resource_->lines_);
+
+    release_();
+    resource_ = resource;
 }
 
-static Doc::LookupResult lookup_binop(glslang::TIntermBinary* binary, const int line, const int col)
+void Doc::adopt_preprocess(Doc const& parsed)
 {
-    if (binary->getOp() != glslang::EOpIndexDirectStruct) {
-        return {Doc::LookupResult::Kind::ERROR};
-    }
+    if (!resource_ || !parsed.resource_ || parsed.resource_->version != resource_->version)
+        return;
 
-    auto loc = binary->getLoc();
-    if (loc.line != line) {
-        return {Doc::LookupResult::Kind::ERROR};
-    }
+    resource_->inactive_blocks_ = parsed.resource_->inactive_blocks_;
+    resource_->pp_key = parsed.resource_->pp_key;
+    resource_->pp = parsed.resource_->pp;
+}
 
-    auto* left = binary->getLeft();
-    auto* right = binary->getRight();
-    const auto rloc = right->getLoc();
-    const auto lloc = left->getLoc();
+void Doc::release_ir()
+{
+    if (!resource_ || !resource_->ir)
+        return;
 
-    bool isref = left->getType().isReference();
-    const auto* members = isref ? left->getType().getReferentType()->getStruct() : left->getType().getStruct();
-    const auto index = right->getAsConstantUnion()->getConstArray()[0].getIConst();
-    const auto field = (*members)[index];
+    // snapshots sharing the resource keep the IR, e.g. the one behind the last completion
+    auto* resource = new __Resource;
+    resource->uri = resource_->uri;
+    resource->version = resource_->version;
+    resource->text_ = resource_->text_;
+    resource->text_dirty_ = resource_->text_dirty_;
+    resource->lines_ = resource_->lines_;
+    resource->language = resource_->language;
+    resource->info_log = resource_->info_log;
+    resource->diagnostics = resource_->diagnostics;
+    resource->diagnostics_key = resource_->diagnostics_key;
+    resource->inactive_blocks_ = resource_->inactive_blocks_;
+    resource->pp_key = resource_->pp_key;
+    resource->pp = resource_->pp;
+    resource->builtins = resource_->builtins;
+    resource->evicted = true;
 
-    if (rloc.column <= col && col <= rloc.column + field.type->getFieldName().size()) {
-        return {Doc::LookupResult::Kind::FIELD, nullptr, field, nullptr};
-    }
+    release_();
+    resource_ = resource;
+}
 
-    if (auto* left_sym = left->getAsSymbolNode()) {
-        if (lloc.line == line && lloc.column <= col && col <= lloc.column + left_sym->getName().size()) {
-            return {Doc::LookupResult::Kind::SYMBOL, left_sym, {}, nullptr};
-        }
+size_t Doc::estimate_memory_usage_(__Resource const& resource)
+{
+    // the text is kept twice, as lines and joined. built-ins live in the shared catalog.
+    size_t size = resource.ir ? resource.ir->memory_usage() : 0;
+    for (auto const& line : resource.lines_) {
+        size += sizeof(std::string) + 2 * (line.size() + 1);
     }
-
-    return {Doc::LookupResult::Kind::ERROR};
+    return size;
 }
 
-void Doc::compute_inactive_blocks_()
+std::string Doc::preamble_() const
 {
-
-    auto p = create_shader();
-    auto& shader = *p;
-    std::map<std::string, std::map<int, int>> pp_cond_res;
-    shader.setPpCondRes(&pp_cond_res);
-
     std::string preambles;
     for (auto const& [k, v] : option_.macros) {
         preambles.append("#define " + k + " " + v + "\n");
@@ -350,280 +422,116 @@ void Doc::compute_inactive_blocks_()
 
     const std::string pound_extension = "#extension GL_GOOGLE_include_directive : enable\n";
     preambles += pound_extension;
-
-    shader.setPreamble(preambles.c_str());
-    shader.setDebugInfo(true);
-
-    const EShMessages rules = static_cast<EShMessages>(EShMsgCascadingErrors | EShMsgSpvRules | EShMsgVulkanRules);
-    auto default_version_ = option_.version;
-    auto default_profile_ = option_.profile;
-    auto force_version_profile_ = false;
-
-    DirStackFileIncluder includer;
-    for (auto& d : option_.include_dirs) {
-        includer.pushExternalLocalDirectory(d);
-    }
-
-    std::string preprocessed_text;
-    bool success = shader.preprocess(&kDefaultTBuiltInResource, default_version_, default_profile_,
-                                     force_version_profile_, false, rules, &preprocessed_text, includer);
-
-    if (!success)
-        return;
-
-    auto& file_cond_res = pp_cond_res[uri()];
-    ComputeInactiveHelper helper(resource_->lines_, file_cond_res);
-    resource_->inactive_blocks_ = helper.inactive();
+    return preambles;
 }
 
-Doc::LookupResult Doc::lookup_node_in_struct(const int line, const int col)
+uint64_t Doc::preprocess_key_(std::string const& text) const
 {
-    auto* func = lookup_func_by_line(line);
-    auto const& tokens = resource_->tokens_by_line[line];
-
-    auto lookup_member_type_fn = [line, col, &tokens](const glslang::TType& type) {
-        if (!type.isStruct()) {
-            return Doc::LookupResult{Doc::LookupResult::Kind::ERROR, nullptr, {}, nullptr};
-        }
-
-        auto const& members = *type.getStruct();
-
-        for (size_t i = 0; i < members.size(); ++i) {
-            auto const& member = members[i];
-            if (member.loc.line != line) {
-                continue;
-            }
-
-            if (col >= member.loc.column) {
-                continue;
-            }
-
-            auto pos = std::find_if(tokens.cbegin(), tokens.cend(), [&member](Token const& tok) {
-                if (tok.lex.loc.column == member.loc.column) {
-                    return true;
-                }
-                return false;
-            });
-
-            if (pos == tokens.cbegin()) {
-                continue;
-            }
-
-            --pos;
-
-            auto const& type_tok = *pos;
-            if (type_tok.tok != IDENTIFIER && type_tok.tok != TYPE_NAME) {
-                continue;
-            }
-
-            const int type_start_col = type_tok.lex.loc.column;
-            const int type_end_col = type_start_col + type_tok.lex.string->size();
-            if (col >= type_start_col && col <= type_end_col) {
-                return Doc::LookupResult{Doc::LookupResult::Kind::TYPE, nullptr, {}, member.type};
-            }
-        }
-
-        return Doc::LookupResult{Doc::LookupResult::Kind::ERROR, nullptr, {}, nullptr};
-    };
-
-    if (func) {
-        for (auto* def : func->userdef_types) {
-            const auto& type = def->getType();
-
-            auto result = lookup_member_type_fn(type);
-            if (result.kind != LookupResult::Kind::ERROR) {
-                return result;
-            }
-        }
+    std::hash<std::string> hasher;
+    uint64_t key = hasher(text);
+    key = hash_combine(key, hasher(uri()));
+    for (auto const& [k, v] : option_.macros) {
+        key = hash_combine(key, hasher(k));
+        key = hash_combine(key, hasher(v));
     }
 
-    for (auto* global : resource_->globals) {
-        auto result = lookup_member_type_fn(global->getType());
-        if (result.kind != LookupResult::Kind::ERROR) {
-            return result;
-        }
+    for (auto const& d : option_.include_dirs) {
+        key = hash_combine(key, hasher(d));
     }
 
-    return Doc::LookupResult{Doc::LookupResult::Kind::ERROR, nullptr, {}, nullptr};
+    key = hash_combine(key, option_.version);
+    key = hash_combine(key, option_.profile);
+    key = hash_combine(key, option_.shader_stage);
+    key = hash_combine(key, language());
+    key = hash_combine(key, option_.client);
+    key = hash_combine(key, option_.client_version);
+    key = hash_combine(key, option_.target_spv);
+    return key;
 }
 
-std::vector<Doc::LookupResult> Doc::lookup_nodes_at(const int line, const int col)
+uint64_t Doc::diagnostics_key_()
 {
-    if (!resource_)
-        return {};
-    std::vector<LookupResult> result;
-
-    if (resource_->nodes_by_line.count(line) <= 0) {
-        auto ty = lookup_node_in_struct(line, col);
-        if (ty.kind != LookupResult::Kind::ERROR) {
-            result.push_back(ty);
-        }
-
-        return result;
-    }
-
-    auto& nodes = resource_->nodes_by_line[line];
-
-    for (auto* node : nodes) {
-        if (auto sym = node->getAsSymbolNode()) {
-            auto loc = sym->getLoc();
-            auto endcol = loc.column + sym->getName().length();
-            if (line == loc.line && loc.column <= col && col <= endcol) {
-                result.push_back({LookupResult::Kind::SYMBOL, sym, {}, nullptr});
-            }
-        } else if (auto binop = node->getAsBinaryNode()) {
-            auto bin_result = lookup_binop(binop, line, col);
-            if (bin_result.kind != LookupResult::Kind::ERROR) {
-                result.push_back(bin_result);
-            }
-        } else if (auto unary = node->getAsUnaryNode()) {
-            if (unary->getOp() != glslang::EOpDeclare) {
-                continue;
-            }
-
-            auto const& ty = unary->getType();
-            if (!ty.isStruct()) {
-                continue;
-            }
-
-            auto loc = unary->getLoc();
-            auto startcol = loc.column;
-            auto endcol = startcol + ty.getTypeName().size();
-
-            if (line == loc.line && startcol <= col && col <= endcol) {
-                result.push_back({LookupResult::Kind::TYPE, nullptr, {}, &ty});
-            }
+    uint64_t key = hash_combine(preprocess_key_(materialize_text_()), resource_->version);
+    if (resource_->pp) {
+        auto& include_cache = IncludeCache::get();
+        for (auto const& [path, hash] : resource_->pp->includes) {
+            key = hash_combine(key, include_cache.hash(path));
         }
     }
-
-    return result;
+    return key;
 }
 
-glslang::TSourceLoc Doc::locate_symbol_def(Doc::FunctionDefDesc* func, glslang::TIntermSymbol* target)
+std::shared_ptr<const PreprocessResult> Doc::preprocess_()
 {
-    if (func) {
-        for (auto sym : func->local_defs) {
-            if (sym->getId() == target->getId()) {
-                return sym->getLoc();
-            }
+    auto const& text = materialize_text_();
+    auto key = preprocess_key_(text);
+    if (resource_->pp && resource_->pp_key == key) {
+        return resource_->pp;
+    }
+
+    static auto& preprocess_time = Stats::get().phase("preprocess");
+    static auto& cache_stats = Stats::get().cache("preprocess");
+    auto& cache = PreprocessCache::get();
+    auto result = cache.find(key);
+    cache_stats.access(result != nullptr);
+    if (!result) {
+        auto p = create_shader();
+        if (!p) {
+            return nullptr;
         }
-    }
 
-    for (auto global : resource_->globals) {
-        if (target->getId() == global->getId()) {
-            return global->getLoc();
-        }
-    }
+        auto& shader = *p;
+        auto preprocessed = std::make_shared<PreprocessResult>();
+        shader.setPpCondRes(&preprocessed->pp_cond_res);
 
-    return {nullptr, 0, 0};
-}
+        auto preambles = preamble_();
+        shader.setPreamble(preambles.c_str());
+        shader.setDebugInfo(true);
 
-glslang::TSourceLoc Doc::locate_userdef_type(int line, const glslang::TType* ty)
-{
-    if (!resource_)
-        return {};
-
-    auto* func = lookup_func_by_line(line);
-    if (func) {
-        for (auto* def : func->userdef_types) {
-            if (def->getType().getTypeName() == ty->getTypeName()) {
-                return def->getLoc();
-            }
-        }
-    }
+        const EShMessages rules =
+            static_cast<EShMessages>(EShMsgCascadingErrors | EShMsgSpvRules | EShMsgVulkanRules);
+        auto default_version_ = option_.version;
+        auto default_profile_ = option_.profile;
+        auto force_version_profile_ = false;
 
-    for (auto* def : resource_->userdef_types) {
-        if (def->getType().getTypeName() == ty->getTypeName()) {
-            return def->getLoc();
+        CachedFileIncluder includer;
+        for (auto& d : option_.include_dirs) {
+            includer.pushExternalLocalDirectory(d);
         }
-    }
 
-    return {nullptr, 0, 0};
-}
+        ScopedTimer timer(preprocess_time);
+        std::string preprocessed_text;
+        preprocessed->success = shader.preprocess(&kDefaultTBuiltInResource, default_version_, default_profile_,
+                                                  force_version_profile_, false, rules, &preprocessed_text, includer);
 
-std::vector<glslang::TIntermSymbol*> Doc::lookup_symbols_by_prefix(Doc::FunctionDefDesc* func,
-                                                                   std::string const& prefix)
-{
-    if (!resource_)
-        return {};
-    std::vector<glslang::TIntermSymbol*> symbols;
-    auto match_fn = [&prefix, &symbols](auto vars) {
-        for (auto& sym : vars) {
-            std::string name = sym->getName().c_str();
-            if (name.size() < prefix.size()) {
-                continue;
-            }
-
-            std::string sub = name.substr(0, prefix.size()).c_str();
-            if (sub == prefix) {
-                symbols.push_back(sym);
-            }
+        auto& include_cache = IncludeCache::get();
+        for (auto const& path : includer.getIncludedFiles()) {
+            preprocessed->includes.emplace_back(IncludeCache::normalize(path), include_cache.hash(path));
         }
-    };
 
-    match_fn(resource_->globals);
-    if (func) {
-        match_fn(func->args);
-        match_fn(func->local_defs);
+        result = preprocessed;
+        cache.insert(key, result);
     }
 
-    return symbols;
-}
-
-std::vector<glslang::TSymbol*> Doc::lookup_builtin_symbols_by_prefix(std::string const& prefix, bool fullname)
-{
-    if (!resource_)
-        return {};
-    auto match_fn = [&prefix, fullname](std::string const& name) {
-        if (prefix.empty())
-            return true;
-
-        return fullname ? prefix == name : prefix == name.substr(0, prefix.size());
-    };
-
-    std::vector<glslang::TSymbol*> results;
-    for (auto* sym : resource_->builtins) {
-        if (match_fn(sym->getName().c_str())) {
-            results.push_back(sym);
-        }
-    }
-
-    return results;
+    resource_->pp_key = key;
+    resource_->pp = result;
+    return result;
 }
 
-glslang::TIntermSymbol* Doc::lookup_symbol_by_name(Doc::FunctionDefDesc* func, std::string const& name)
+void Doc::compute_inactive_blocks_()
 {
-    if (func) {
-        for (auto* def : func->local_defs) {
-            if (name == def->getName().c_str()) {
-                return def;
-            }
-        }
-
-        for (auto* def : func->args) {
-            if (name == def->getName().c_str()) {
-                return def;
-            }
-        }
-    }
-
-    for (auto& sym : resource_->globals) {
-        if (name == sym->getName().c_str()) {
-            return sym;
-        }
-    }
+    auto result = preprocess_();
+    if (!result || !result->success)
+        return;
 
-    return nullptr;
+    static const std::map<int, int> empty;
+    auto pos = result->pp_cond_res.find(uri());
+    auto const& file_cond_res = pos == result->pp_cond_res.end() ? empty : pos->second;
+    ComputeInactiveHelper helper(resource_->lines_, file_cond_res);
+    resource_->inactive_blocks_ = helper.inactive();
 }
 
-Doc::FunctionDefDesc* Doc::lookup_func_by_line(int line)
+BuiltinCatalog::Range Doc::lookup_builtins_by_prefix(std::string_view prefix) const
 {
-    if (!resource_)
-        return nullptr;
-    for (auto& func : resource_->func_defs) {
-        if (func.start.line <= line && func.end.line >= line) {
-            return &func;
-        }
-    }
-    return nullptr;
+    return builtins() ? builtins()->lookup(prefix) : BuiltinCatalog::Range{};
 }
@@ -1,20 +1,24 @@
 #ifndef __GLSLX_DOC_HPP__
 #define __GLSLX_DOC_HPP__
 #include "args.hpp"
+#include "builtin_catalog.hpp"
 #include "compute_inactive.hpp"
 #include "extractors.hpp"
 #include "glslang/MachineIndependent/localintermediate.h"
 #include "glslang/Public/ShaderLang.h"
+#include "lsp_defs.hpp"
 #include "parser.hpp"
+#include "preprocess.hpp"
+#include "doc_ir.hpp"
 #include <map>
 #include <memory>
 #include <string>
+#include <string_view>
 #include <tuple>
 #include <vector>
 
 class Doc {
 public:
-    using FunctionDefDesc = DocInfoExtractor::FunctionDefDesc;
     Doc();
     Doc(std::string const& uri, const int version, std::string const& text, CompileOption const& option = {});
     Doc(const Doc& rhs);
@@ -23,7 +27,18 @@ public:
     Doc& operator=(Doc&& doc);
     virtual ~Doc();
 
+    // parse, extract the IR and free the AST
     bool parse();
+    // take the parse results of a snapshot of this document
+    void adopt(Doc&& parsed);
+    // take the preprocessor pass of a snapshot of the same version that failed to parse
+    void adopt_preprocess(Doc const& parsed);
+    // drop the IR. text, diagnostics and inactive blocks are kept, parse() brings the rest back.
+    void release_ir();
+    // the IR was released and not parsed again since
+    bool evicted() const { return resource_ && resource_->evicted; }
+    // rough size of what the last successful parse holds, 0 without an IR
+    size_t memory_usage() const { return resource_ && resource_->ir ? resource_->memory_usage : 0; }
     void update(const int version, std::string const& text)
     {
         if (resource_->version >= version)
@@ -32,13 +47,37 @@ public:
         set_text(text);
     }
 
+    // edits only the lines, the inactive blocks come from the parse snapshot of the new version, see adopt()
+    void update(const int version, std::vector<TextDocumentContentChangeEvent> const& changes,
+                PositionEncoding encoding = PositionEncoding::UTF16);
+
     int version() const { return resource_->version; }
+    // differs for every successful parse, 0 before the first one
+    uint64_t parse_id() const { return resource_ ? resource_->parse_id : 0; }
     std::vector<std::string> const& lines() const { return resource_->lines_; }
     auto const& inactive_blocks() const { return resource_->inactive_blocks_; }
+    bool includes(std::string const& path) const
+    {
+        if (!resource_ || !resource_->pp)
+            return false;
+
+        for (auto const& [include, hash] : resource_->pp->includes) {
+            if (include == path)
+                return true;
+        }
+        return false;
+    }
+    // headers reached by the last preprocessor pass and the IncludeCache hash of their content
+    std::vector<std::pair<std::string, uint64_t>> includes() const
+    {
+        if (!resource_ || !resource_->pp)
+            return {};
+        return resource_->pp->includes;
+    }
     const char* text()
     {
         if (resource_)
-            return resource_->text_.c_str();
+            return materialize_text_().c_str();
         return nullptr;
     }
     std::string const& uri() const { return resource_->uri; }
@@ -47,57 +86,64 @@ public:
     void set_text(std::string const& text);
     void set_uri(std::string const& uri) { resource_->uri = uri; }
 
-    std::vector<glslang::TIntermSymbol*> lookup_symbols_by_prefix(Doc::FunctionDefDesc* func,
-                                                                  std::string const& prefix);
-    std::vector<glslang::TSymbol*> lookup_builtin_symbols_by_prefix(std::string const& prefix, bool fullname = false);
-    FunctionDefDesc* lookup_func_by_line(int line);
-    const std::vector<FunctionDefDesc>& func_defs() { return resource_->func_defs; }
-    const std::vector<glslang::TIntermSymbol*>& userdef_types() { return resource_->userdef_types; }
-    const std::vector<glslang::TIntermSymbol*>& globals() { return resource_->globals; }
+    BuiltinCatalog::Range lookup_builtins_by_prefix(std::string_view prefix) const;
+    // built-ins of the language of the last successful parse, shared with every document of that language
+    BuiltinCatalog const* builtins() const { return resource_ ? resource_->builtins : nullptr; }
 
-    glslang::TIntermSymbol* lookup_symbol_by_name(Doc::FunctionDefDesc* func, std::string const& name);
-    glslang::TIntermediate* intermediate()
+    const char* info_log() { return resource_ ? resource_->info_log.c_str() : ""; }
+    void set_info_log(std::string const& info_log)
     {
-        return (resource_ && resource_->shader) ? resource_->shader->getIntermediate() : nullptr;
+        if (resource_)
+            resource_->info_log = info_log;
     }
+    // messages of the last parse, a successful one can still have warnings
+    std::vector<Diagnostic> const& diagnostics() const
+    {
+        static const std::vector<Diagnostic> empty;
+        return resource_ ? resource_->diagnostics : empty;
+    }
+    // the text, version, options and header contents the diagnostics were computed from, hashed
+    uint64_t diagnostics_key() const { return resource_ ? resource_->diagnostics_key : 0; }
+    void set_diagnostics(std::vector<Diagnostic> const& diagnostics, uint64_t key)
+    {
+        if (resource_) {
+            resource_->diagnostics = diagnostics;
+            resource_->diagnostics_key = key;
+        }
+    }
+    CompileOption const& option() const { return option_; }
 
-    const char* info_log() { return resource_ ? resource_->info_log.c_str() : ""; }
-
-    struct LookupResult {
-        enum class Kind { SYMBOL, FIELD, TYPE, ERROR } kind;
-        glslang::TIntermSymbol* sym;
-        glslang::TTypeLoc field;
-        const glslang::TType* ty;
-    };
-
-    std::vector<LookupResult> lookup_nodes_at(const int line, const int col);
-    glslang::TSourceLoc locate_symbol_def(Doc::FunctionDefDesc* func, glslang::TIntermSymbol* use);
-    glslang::TSourceLoc locate_userdef_type(int line, const glslang::TType* use);
+    // what the last successful parse extracted from the AST
+    DocIR const* ir() const { return resource_ ? resource_->ir.get() : nullptr; }
+    // the same, for whoever outlives the document or its next parse
+    std::shared_ptr<const DocIR> shared_ir() const { return resource_ ? resource_->ir : nullptr; }
 
     using Range = ComputeInactiveHelper::Range;
 
 private:
-    typedef decltype(YYSTYPE::lex) lex_info_type;
-    struct Token {
-        int tok;
-        lex_info_type lex;
-    };
     struct __Resource {
         std::string uri;
         int version;
+        // lines_ is the source of truth, incremental changes only touch the edited lines and
+        // text_ is joined again on demand.
         std::string text_;
+        bool text_dirty_ = false;
         std::vector<std::string> lines_;
         EShLanguage language;
-        std::unique_ptr<glslang::TShader> shader;
 
-        std::map<int, std::vector<TIntermNode*>> nodes_by_line;
-        std::vector<FunctionDefDesc> func_defs;
-        std::vector<glslang::TIntermSymbol*> globals;
-        std::vector<glslang::TIntermSymbol*> userdef_types;
-        std::map<int, std::vector<Token>> tokens_by_line;
-        std::vector<glslang::TSymbol*> builtins;
+        // shared with the completion items collected from it
+        std::shared_ptr<const DocIR> ir;
+        BuiltinCatalog const* builtins = nullptr;
         std::string info_log;
+        std::vector<Diagnostic> diagnostics;
+        uint64_t diagnostics_key = 0;
         std::vector<Range> inactive_blocks_;
+        // preprocessor pass of the current text, shared with PreprocessCache
+        uint64_t pp_key = 0;
+        std::shared_ptr<const PreprocessResult> pp;
+        uint64_t parse_id = 0;
+        bool evicted = false;
+        size_t memory_usage = 0;
         int ref = 1;
     };
 
@@ -105,11 +151,16 @@ private:
 
     __Resource* resource_;
     void infer_language_();
-    void tokenize_(CompileOption const& option);
     void release_();
+    void apply_change_(::Range const& range, std::string const& text, PositionEncoding encoding);
+    std::string const& materialize_text_();
 
-    LookupResult lookup_node_in_struct(const int line, const int col);
     void compute_inactive_blocks_();
+    static size_t estimate_memory_usage_(__Resource const& resource);
+    std::string preamble_() const;
+    uint64_t preprocess_key_(std::string const& text) const;
+    uint64_t diagnostics_key_();
+    std::shared_ptr<const PreprocessResult> preprocess_();
     std::unique_ptr<glslang::TShader> create_shader();
 };
 #endif
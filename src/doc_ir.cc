@@ -0,0 +1,456 @@
+#include "doc_ir.hpp"
+#include <algorithm>
+#include <functional>
+#include <tuple>
+
+std::string print_type(const glslang::TType& type)
+{
+    // the printed TString lives in a pool of its own, not in the one of whoever asks
+    auto* previous = &glslang::GetThreadPoolAllocator();
+    glslang::TPoolAllocator pool;
+    glslang::SetThreadPoolAllocator(&pool);
+    std::string str = type.getCompleteString(true, false, false).c_str();
+    glslang::SetThreadPoolAllocator(previous);
+    return str;
+}
+
+DocIR::StrId DocIR::intern_(std::string_view s)
+{
+    auto pos = string_ids_.find(s);
+    if (pos != string_ids_.end()) {
+        return pos->second;
+    }
+
+    auto id = static_cast<StrId>(strings_.size());
+    strings_.emplace_back(s);
+    string_ids_.emplace(strings_.back(), id);
+    return id;
+}
+
+DocIR::Loc DocIR::loc_(glslang::TSourceLoc const& loc)
+{
+    return {loc.getFilename() ? intern_(loc.getFilename()) : 0, loc.line, loc.column};
+}
+
+bool DocIR::loc_less_(Loc const& lhs, Loc const& rhs) const
+{
+    if (lhs.file != rhs.file) {
+        return str(lhs.file) < str(rhs.file);
+    }
+    return lhs.line < rhs.line || (lhs.line == rhs.line && lhs.column < rhs.column);
+}
+
+void DocIR::build(std::string const& uri, glslang::TIntermediate const& intermediate,
+                  std::vector<glslang::TIntermSymbol*> const& globals, std::vector<FunctionDefDesc> const& funcs,
+                  std::vector<glslang::TIntermSymbol*> const& userdef_types, std::vector<NodePosition> const& positions)
+{
+    *this = DocIR();
+    intern_("");
+    const StrId doc_file = intern_(uri);
+    version_ = intermediate.getVersion();
+    profile_ = intermediate.getProfile();
+    stage_ = intermediate.getStage();
+    spv_ = intermediate.getSpv();
+    entrypoint_ = intermediate.getEntryPointName();
+
+    // a type is printed once however many symbols share it
+    std::unordered_map<const glslang::TType*, StrId> printed;
+    auto type_of = [this, &printed](glslang::TType const& type) {
+        auto pos = printed.find(&type);
+        if (pos != printed.end()) {
+            return pos->second;
+        }
+        auto id = intern_(print_type(type));
+        printed.emplace(&type, id);
+        return id;
+    };
+
+    std::unordered_map<const glslang::TTypeList*, uint32_t> struct_ids;
+    std::function<Shape(glslang::TType const&, uint32_t)> shape_of;
+    auto add_struct = [&](glslang::TType const& type, Loc const& loc, uint32_t scope) {
+        auto* members = type.getStruct();
+        auto pos = struct_ids.find(members);
+        if (pos != struct_ids.end()) {
+            return pos->second;
+        }
+
+        std::string_view name = type.getTypeName().c_str();
+        if (loc.line == 0) {
+            // a copy of a declared type, found by name in the scope first and then globally
+            uint32_t declared = kNone;
+            for (uint32_t i = 0; i < structs_.size(); ++i) {
+                auto const& s = structs_[i];
+                if (s.loc.line > 0 && str(s.name) == name &&
+                    (s.scope == scope || (s.scope == kNone && declared == kNone))) {
+                    declared = i;
+                }
+            }
+
+            if (declared != kNone) {
+                struct_ids.emplace(members, declared);
+                return declared;
+            }
+        }
+
+        auto id = static_cast<uint32_t>(structs_.size());
+        auto first_field = static_cast<uint32_t>(fields_.size());
+        structs_.push_back(
+            {intern_(name), type_of(type), loc, scope, first_field, static_cast<uint32_t>(members->size())});
+        for (auto const& member : *members) {
+            fields_.push_back({intern_(member.type->getFieldName().c_str()), type_of(*member.type), loc_(member.loc)});
+        }
+        // before the shapes of the fields, a buffer reference may point back at its own block
+        struct_ids.emplace(members, id);
+        for (uint32_t i = 0; i < members->size(); ++i) {
+            auto shape = shape_of(*(*members)[i].type, scope);
+            fields_[first_field + i].shape = shape;
+        }
+        return id;
+    };
+
+    shape_of = [&](glslang::TType const& t, uint32_t scope) {
+        auto const& type = t.isReference() ? *t.getReferentType() : t;
+        Shape shape;
+        shape.basic = intern_(type.getBasicTypeString().c_str());
+        if (type.isStruct()) {
+            shape.struct_index = add_struct(type, {}, scope);
+        }
+        if (type.isVector()) {
+            shape.vector_size = static_cast<uint8_t>(type.getVectorSize());
+        }
+        if (type.isArray()) {
+            shape.array_dims = static_cast<uint8_t>(type.getArraySizes()->getNumDims());
+        }
+        return shape;
+    };
+
+    for (auto* t : userdef_types) {
+        if (t->getType().isStruct())
+            add_struct(t->getType(), loc_(t->getLoc()), kNone);
+    }
+
+    std::unordered_map<long long, uint32_t> variable_ids;
+    // keyed by mangled name, overloads are different functions
+    std::unordered_map<std::string, uint32_t> function_ids;
+    auto declare = [&](glslang::TIntermSymbol* sym, bool global, Symbol::Kind kind, uint32_t scope) {
+        auto storage = sym->getType().getQualifier().storage;
+        bool readonly = storage == glslang::EvqConst || storage == glslang::EvqConstReadOnly;
+        auto shape = shape_of(sym->getType(), scope);
+        auto id = static_cast<uint32_t>(symbols_.size());
+        symbols_.push_back({kind, intern_(sym->getName().c_str()), type_of(sym->getType()), loc_(sym->getLoc()),
+                            global, readonly, shape, {}});
+        variable_ids.emplace(sym->getId(), id);
+        return id;
+    };
+
+    for (auto* g : globals) {
+        declare(g, true, Symbol::Kind::VARIABLE, kNone);
+    }
+
+    for (uint32_t i = 0; i < funcs.size(); ++i) {
+        auto const& func = funcs[i];
+        std::string signature = str(type_of(func.def->getType())) + " " + func.name + "(";
+        for (size_t k = 0; k < func.args.size(); ++k) {
+            if (k > 0)
+                signature += ", ";
+            signature += str(type_of(func.args[k]->getType()));
+            signature += " ";
+            signature += func.args[k]->getName().c_str();
+        }
+        signature += ")";
+
+        // local struct types first, the shapes of the locals refer to them
+        for (auto* t : func.userdef_types) {
+            if (t->getType().isStruct())
+                add_struct(t->getType(), loc_(t->getLoc()), i);
+        }
+
+        auto result = shape_of(func.def->getType(), kNone);
+        auto id = static_cast<uint32_t>(symbols_.size());
+        symbols_.push_back({Symbol::Kind::FUNCTION, intern_(func.name), intern_(signature), loc_(func.start), true,
+                            false, result, {}});
+        function_ids.emplace(func.def->getName().c_str(), id);
+
+        for (auto* arg : func.args) {
+            declare(arg, false, Symbol::Kind::PARAMETER, i);
+        }
+        uint32_t locals = 0;
+        for (auto* def : func.local_defs) {
+            if (def) {
+                declare(def, false, Symbol::Kind::VARIABLE, i);
+                ++locals;
+            }
+        }
+        functions_.push_back(
+            {id, loc_(func.start), loc_(func.end), static_cast<uint32_t>(func.args.size()), locals});
+    }
+
+    for (auto const& func : funcs) {
+        for (auto* use : func.local_uses) {
+            auto pos = variable_ids.find(use->getId());
+            auto loc = loc_(use->getLoc());
+            if (pos != variable_ids.end() && !(loc == symbols_[pos->second].decl)) {
+                symbols_[pos->second].uses.push_back(loc);
+            }
+        }
+
+        for (auto* call : func.calls) {
+            auto pos = function_ids.find(call->getName().c_str());
+            if (pos != function_ids.end()) {
+                symbols_[pos->second].uses.push_back(loc_(call->getLoc()));
+            }
+        }
+    }
+
+    auto less = [this](Loc const& lhs, Loc const& rhs) { return loc_less_(lhs, rhs); };
+    for (uint32_t i = 0; i < symbols_.size(); ++i) {
+        auto& symbol = symbols_[i];
+        std::sort(symbol.uses.begin(), symbol.uses.end(), less);
+        symbol.uses.erase(std::unique(symbol.uses.begin(), symbol.uses.end()), symbol.uses.end());
+
+        // members of anonymous blocks are used through the block
+        if (str(symbol.name).compare(0, 5, "anon@") == 0) {
+            continue;
+        }
+
+        if (symbol.decl.file == doc_file) {
+            positions_.push_back({symbol.decl.line, symbol.decl.column, i});
+        }
+        for (auto const& loc : symbol.uses) {
+            if (loc.file == doc_file)
+                positions_.push_back({loc.line, loc.column, i});
+        }
+    }
+
+    std::sort(positions_.begin(), positions_.end(), [](Position const& lhs, Position const& rhs) {
+        return lhs.line < rhs.line || (lhs.line == rhs.line && lhs.column < rhs.column);
+    });
+
+    for (uint32_t i = 0; i < functions_.size(); ++i) {
+        if (functions_[i].start.file == doc_file)
+            function_order_.push_back(i);
+    }
+    std::sort(function_order_.begin(), function_order_.end(),
+              [this](uint32_t lhs, uint32_t rhs) { return functions_[lhs].start.line < functions_[rhs].start.line; });
+
+    // built-ins and other symbols declared out of reach of the extractors have no declaration
+    auto symbol_of = [&](glslang::TIntermSymbol* sym) {
+        auto pos = variable_ids.find(sym->getId());
+        if (pos != variable_ids.end()) {
+            return pos->second;
+        }
+        auto id = declare(sym, false, Symbol::Kind::VARIABLE, kNone);
+        symbols_[id].decl = {};
+        return id;
+    };
+
+    auto in_doc = [&uri](glslang::TSourceLoc const& loc) { return loc.getFilename() && uri == loc.getFilename(); };
+    for (auto const& p : positions) {
+        if (!in_doc(p.node->getLoc())) {
+            continue;
+        }
+
+        switch (p.kind) {
+        case NodePosition::Kind::SYMBOL:
+            occurrences_.push_back(
+                {p.line, p.column, p.end_column, Occurrence::Kind::SYMBOL, symbol_of(p.node->getAsSymbolNode())});
+            break;
+        case NodePosition::Kind::FIELD: {
+            auto* binary = p.node->getAsBinaryNode();
+            auto* left = binary->getLeft();
+            auto* index = binary->getRight()->getAsConstantUnion();
+            auto const& type = left->getType().isReference() ? *left->getType().getReferentType() : left->getType();
+            if (!index || !type.getStruct()) {
+                break;
+            }
+
+            auto s = add_struct(type, {}, function_at(p.line));
+            auto i = static_cast<uint32_t>(index->getConstArray()[0].getIConst());
+            if (i >= structs_[s].field_count) {
+                break;
+            }
+            auto const& rloc = index->getLoc();
+            auto const& field = fields_[structs_[s].first_field + i];
+            occurrences_.push_back({rloc.line, rloc.column, rloc.column + static_cast<int>(str(field.name).size()),
+                                    Occurrence::Kind::FIELD, structs_[s].first_field + i});
+
+            if (auto* sym = left->getAsSymbolNode()) {
+                auto const& lloc = sym->getLoc();
+                occurrences_.push_back({lloc.line, lloc.column, lloc.column + static_cast<int>(sym->getName().size()),
+                                        Occurrence::Kind::SYMBOL, symbol_of(sym)});
+            }
+            break;
+        }
+        case NodePosition::Kind::TYPE:
+            occurrences_.push_back({p.line, p.column, p.end_column, Occurrence::Kind::TYPE,
+                                    add_struct(p.node->getAsUnaryNode()->getType(), {}, function_at(p.line))});
+            break;
+        }
+    }
+
+    auto occurrence_less = [](Occurrence const& lhs, Occurrence const& rhs) {
+        return std::tie(lhs.line, lhs.column, lhs.kind, lhs.target) <
+               std::tie(rhs.line, rhs.column, rhs.kind, rhs.target);
+    };
+    auto occurrence_equal = [](Occurrence const& lhs, Occurrence const& rhs) {
+        return lhs.line == rhs.line && lhs.column == rhs.column && lhs.kind == rhs.kind && lhs.target == rhs.target;
+    };
+    std::sort(occurrences_.begin(), occurrences_.end(), occurrence_less);
+    occurrences_.erase(std::unique(occurrences_.begin(), occurrences_.end(), occurrence_equal), occurrences_.end());
+
+    for (uint32_t i = 0; i < structs_.size(); ++i) {
+        if (structs_[i].loc.line > 0)
+            struct_order_.push_back(i);
+    }
+    std::sort(struct_order_.begin(), struct_order_.end(),
+              [this](uint32_t lhs, uint32_t rhs) { return str(structs_[lhs].name) < str(structs_[rhs].name); });
+
+    build_name_indexes_();
+
+    // only needed while interning
+    string_ids_ = {};
+}
+
+void DocIR::build_name_indexes_()
+{
+    local_names_.resize(functions_.size());
+    local_type_names_.resize(functions_.size());
+    for (uint32_t i = 0; i < functions_.size(); ++i) {
+        auto const& func = functions_[i];
+        function_names_.add(str(symbols_[func.symbol].name), i);
+
+        // locals first, find_variable prefers them to a parameter of the same name
+        auto& locals = local_names_[i];
+        const uint32_t first_param = func.symbol + 1;
+        const uint32_t first_local = first_param + func.param_count;
+        for (uint32_t k = first_local; k < first_local + func.local_count; ++k) {
+            locals.add(str(symbols_[k].name), k);
+        }
+        for (uint32_t k = first_param; k < first_local; ++k) {
+            locals.add(str(symbols_[k].name), k);
+        }
+        locals.build();
+    }
+    function_names_.build();
+
+    for (uint32_t i = 0; i < symbols_.size(); ++i) {
+        auto const& symbol = symbols_[i];
+        if (symbol.global && symbol.kind == Symbol::Kind::VARIABLE)
+            global_names_.add(str(symbol.name), i);
+    }
+    global_names_.build();
+
+    for (uint32_t i = 0; i < structs_.size(); ++i) {
+        auto const& s = structs_[i];
+        if (s.loc.line == 0) {
+            continue;
+        }
+        auto& names = s.scope == kNone ? global_type_names_ : local_type_names_[s.scope];
+        names.add(str(s.name), i);
+    }
+    global_type_names_.build();
+    for (auto& names : local_type_names_) {
+        names.build();
+    }
+}
+
+std::vector<DocIR::Occurrence> DocIR::lookup(const int line, const int col) const
+{
+    auto first = std::lower_bound(occurrences_.begin(), occurrences_.end(), line,
+                                  [](Occurrence const& o, const int line) { return o.line < line; });
+
+    std::vector<Occurrence> result;
+    for (auto pos = first; pos != occurrences_.end() && pos->line == line; ++pos) {
+        if (pos->column <= col && col <= pos->end_column) {
+            result.push_back(*pos);
+        }
+    }
+    return result;
+}
+
+DocIR::Symbol const* DocIR::lookup_symbol(const int line, const int col) const
+{
+    // the last position on line starting at or before col
+    auto pos = std::upper_bound(positions_.begin(), positions_.end(), std::make_pair(line, col),
+                                [](std::pair<int, int> const& key, Position const& p) {
+                                    return key.first < p.line || (key.first == p.line && key.second < p.column);
+                                });
+    if (pos == positions_.begin()) {
+        return nullptr;
+    }
+
+    --pos;
+    auto const& symbol = symbols_[pos->symbol];
+    if (pos->line != line || col > pos->column + static_cast<int>(str(symbol.name).size())) {
+        return nullptr;
+    }
+
+    return &symbol;
+}
+
+uint32_t DocIR::function_at(const int line) const
+{
+    auto pos = std::upper_bound(function_order_.begin(), function_order_.end(), line,
+                                [this](const int line, uint32_t f) { return line < functions_[f].start.line; });
+    if (pos == function_order_.begin()) {
+        return kNone;
+    }
+
+    --pos;
+    return functions_[*pos].end.line >= line ? *pos : kNone;
+}
+
+DocIR::Struct const* DocIR::find_struct(std::string_view name, uint32_t scope) const
+{
+    auto [first, last] = std::equal_range(
+        struct_order_.begin(), struct_order_.end(), name,
+        [this](auto const& lhs, auto const& rhs) { return name_of_(lhs) < name_of_(rhs); });
+    for (auto pos = first; pos != last; ++pos) {
+        if (structs_[*pos].scope == scope)
+            return &structs_[*pos];
+    }
+    return nullptr;
+}
+
+DocIR::NameRange DocIR::locals_by_prefix(uint32_t function, std::string_view prefix) const
+{
+    return function < local_names_.size() ? local_names_[function].lookup(prefix) : NameRange{};
+}
+
+DocIR::NameRange DocIR::types_by_prefix(uint32_t function, std::string_view prefix) const
+{
+    if (function == kNone)
+        return global_type_names_.lookup(prefix);
+    return function < local_type_names_.size() ? local_type_names_[function].lookup(prefix) : NameRange{};
+}
+
+DocIR::Symbol const* DocIR::find_variable(uint32_t function, std::string_view name) const
+{
+    if (function < local_names_.size()) {
+        auto found = local_names_[function].find(name);
+        if (!found.empty())
+            return &symbols_[found.begin()->value];
+    }
+
+    auto found = global_names_.find(name);
+    return found.empty() ? nullptr : &symbols_[found.begin()->value];
+}
+
+size_t DocIR::memory_usage() const
+{
+    size_t size = sizeof(DocIR);
+    for (auto const& s : strings_) {
+        size += sizeof(std::string) + s.capacity();
+    }
+    size += symbols_.capacity() * sizeof(Symbol);
+    for (auto const& symbol : symbols_) {
+        size += symbol.uses.capacity() * sizeof(Loc);
+    }
+    size += structs_.capacity() * sizeof(Struct) + fields_.capacity() * sizeof(Field);
+    size += functions_.capacity() * sizeof(Function) + occurrences_.capacity() * sizeof(Occurrence);
+    size += positions_.capacity() * sizeof(Position);
+    size += (function_order_.capacity() + struct_order_.capacity()) * sizeof(uint32_t);
+    // one entry per symbol, function and struct across the name indexes
+    size += (symbols_.size() + functions_.size() + structs_.size()) * sizeof(PrefixIndex<uint32_t>::Entry);
+    return size;
+}
@@ -0,0 +1,188 @@
+#ifndef __GLSLX_DOC_IR_HPP__
+#define __GLSLX_DOC_IR_HPP__
+#include "extractors.hpp"
+#include "glslang/MachineIndependent/localintermediate.h"
+#include "prefix_index.hpp"
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+// getCompleteString(true, false, false) of type, printed in a pool of its own
+std::string print_type(const glslang::TType& type);
+
+// what definition, hover, references, completion, symbols and semantic tokens need of a parse, extracted
+// once from the AST. nothing in it points into the AST: names, files and printed types are interned,
+// struct layouts are flattened into one array of fields and symbols refer to each other by index.
+// it is all a Doc keeps of a parse, the AST is freed once it is built.
+class DocIR {
+public:
+    using FunctionDefDesc = DocInfoExtractor::FunctionDefDesc;
+    // index of an interned string, 0 is the empty string
+    using StrId = uint32_t;
+    static constexpr uint32_t kNone = UINT32_MAX;
+
+    // 1-based like glslang::TSourceLoc, line 0 if unknown, e.g. built-ins
+    struct Loc {
+        StrId file = 0;
+        int line = 0;
+        int column = 0;
+
+        bool operator==(Loc const& rhs) const { return line == rhs.line && column == rhs.column && file == rhs.file; }
+    };
+
+    // what completion follows an access chain like a.b[i].c with, references are seen through
+    struct Shape {
+        // getBasicTypeString(), e.g. float for a vec3
+        StrId basic = 0;
+        // index in structs() of a struct or block, kNone otherwise
+        uint32_t struct_index = kNone;
+        // 0 unless a vector
+        uint8_t vector_size = 0;
+        // 0 unless an array
+        uint8_t array_dims = 0;
+    };
+
+    struct Field {
+        StrId name;
+        StrId type;
+        Loc loc;
+        Shape shape;
+    };
+
+    struct Struct {
+        StrId name;
+        StrId type;
+        // line 0 for blocks and structs whose declaration was not seen
+        Loc loc;
+        // function the struct is declared in, kNone at global scope
+        uint32_t scope;
+        uint32_t first_field;
+        uint32_t field_count;
+    };
+
+    struct Symbol {
+        enum class Kind : uint8_t { VARIABLE, PARAMETER, FUNCTION };
+
+        Kind kind;
+        StrId name;
+        // the printed type, the signature for functions
+        StrId type;
+        Loc decl;
+        // global variable or function, other files including the declaration may use it too
+        bool global;
+        // const variables and parameters
+        bool readonly;
+        // of the result for functions
+        Shape shape;
+        // sorted by file, line and column, decl excluded
+        std::vector<Loc> uses;
+    };
+
+    struct Function {
+        uint32_t symbol;
+        Loc start;
+        Loc end;
+        // the parameters are the first param_count symbols after symbol, its locals follow them
+        uint32_t param_count;
+        uint32_t local_count;
+    };
+
+    // a name of the document lookup() resolves, columns [column, end_column]
+    struct Occurrence {
+        enum class Kind : uint8_t { SYMBOL, FIELD, TYPE };
+
+        int line;
+        int column;
+        int end_column;
+        Kind kind;
+        // index in symbols(), fields() or structs()
+        uint32_t target;
+    };
+
+    void build(std::string const& uri, glslang::TIntermediate const& intermediate,
+               std::vector<glslang::TIntermSymbol*> const& globals, std::vector<FunctionDefDesc> const& funcs,
+               std::vector<glslang::TIntermSymbol*> const& userdef_types, std::vector<NodePosition> const& positions);
+
+    std::string const& str(StrId id) const { return strings_[id]; }
+    std::vector<Symbol> const& symbols() const { return symbols_; }
+    std::vector<Struct> const& structs() const { return structs_; }
+    std::vector<Field> const& fields() const { return fields_; }
+    std::vector<Function> const& functions() const { return functions_; }
+
+    // names at line:col, 1-based
+    std::vector<Occurrence> lookup(const int line, const int col) const;
+    // the declaration of the document covering line:col or the one used there, with all its uses
+    Symbol const* lookup_symbol(const int line, const int col) const;
+    // index of the function of the document whose body covers line, kNone outside functions
+    uint32_t function_at(const int line) const;
+    // struct named name declared in function scope, or at global scope with kNone
+    Struct const* find_struct(std::string_view name, uint32_t scope) const;
+
+    // names starting with prefix, the values index symbols(), structs() and functions()
+    using NameRange = PrefixIndex<uint32_t>::Range;
+    // global variables, anonymous blocks are named anon@
+    NameRange globals_by_prefix(std::string_view prefix) const { return global_names_.lookup(prefix); }
+    // parameters and locals of function, none with kNone
+    NameRange locals_by_prefix(uint32_t function, std::string_view prefix) const;
+    // structs declared in function, or at global scope with kNone
+    NameRange types_by_prefix(uint32_t function, std::string_view prefix) const;
+    NameRange functions_by_prefix(std::string_view prefix) const { return function_names_.lookup(prefix); }
+    // the variable named name in function, its locals hide the globals
+    Symbol const* find_variable(uint32_t function, std::string_view name) const;
+
+    // the language of the parse, what the built-in catalog and the completion lexer are created for
+    int version() const { return version_; }
+    EProfile profile() const { return profile_; }
+    EShLanguage stage() const { return stage_; }
+    glslang::SpvVersion const& spv() const { return spv_; }
+    std::string const& entrypoint() const { return entrypoint_; }
+
+    // rough size of what it holds
+    size_t memory_usage() const;
+
+private:
+    struct Position {
+        int line;
+        int column;
+        uint32_t symbol;
+    };
+
+    // deque, the views in string_ids_ stay valid as strings are added
+    std::deque<std::string> strings_;
+    // emptied once built
+    std::unordered_map<std::string_view, StrId> string_ids_;
+    std::vector<Symbol> symbols_;
+    std::vector<Struct> structs_;
+    std::vector<Field> fields_;
+    std::vector<Function> functions_;
+    // sorted by line and column
+    std::vector<Occurrence> occurrences_;
+    // declarations and uses in the document, sorted by line and column
+    std::vector<Position> positions_;
+    // functions of the document sorted by start line
+    std::vector<uint32_t> function_order_;
+    // declared structs sorted by name
+    std::vector<uint32_t> struct_order_;
+    PrefixIndex<uint32_t> global_names_;
+    PrefixIndex<uint32_t> global_type_names_;
+    PrefixIndex<uint32_t> function_names_;
+    // parallel to functions_
+    std::vector<PrefixIndex<uint32_t>> local_names_;
+    std::vector<PrefixIndex<uint32_t>> local_type_names_;
+    int version_ = 0;
+    EProfile profile_ = ENoProfile;
+    EShLanguage stage_ = EShLangVertex;
+    glslang::SpvVersion spv_;
+    std::string entrypoint_ = "main";
+
+    StrId intern_(std::string_view s);
+    void build_name_indexes_();
+    Loc loc_(glslang::TSourceLoc const& loc);
+    bool loc_less_(Loc const& lhs, Loc const& rhs) const;
+    std::string_view name_of_(uint32_t s) const { return str(structs_[s].name); }
+    std::string_view name_of_(std::string_view name) const { return name; }
+};
+#endif
@@ -1,15 +1,55 @@
 #ifndef __GLSLX_EXTRACTORS_HPP__
 #define __GLSLX_EXTRACTORS_HPP__
 #include "glslang/Include/intermediate.h"
+#include <cstdint>
 #include <cstdio>
 #include <iostream>
+#include <vector>
+
+// a node DocIR::lookup can resolve and where it starts, DocIR::build turns them into occurrences
+struct NodePosition {
+    enum class Kind : uint8_t { SYMBOL, FIELD, TYPE };
+
+    int line;
+    int column;
+    // last column covered by the name, FIELD nodes are resolved from their operands
+    int end_column;
+    Kind kind;
+    TIntermNode* node;
+
+    bool operator<(NodePosition const& rhs) const
+    {
+        return line < rhs.line || (line == rhs.line && column < rhs.column);
+    }
+};
+
+// record the nodes DocIR::lookup understands, everything else is left out of the index
+inline void add_node_position(std::vector<NodePosition>& positions, TIntermNode* node)
+{
+    auto const& loc = node->getLoc();
+    if (auto* sym = node->getAsSymbolNode()) {
+        positions.push_back({loc.line, loc.column, loc.column + static_cast<int>(sym->getName().length()),
+                             NodePosition::Kind::SYMBOL, node});
+    } else if (auto* binary = node->getAsBinaryNode()) {
+        if (binary->getOp() == glslang::EOpIndexDirectStruct) {
+            positions.push_back({loc.line, loc.column, loc.column, NodePosition::Kind::FIELD, node});
+        }
+    } else if (auto* unary = node->getAsUnaryNode()) {
+        auto const& type = unary->getType();
+        if (unary->getOp() == glslang::EOpDeclare && type.isStruct()) {
+            positions.push_back({loc.line, loc.column, loc.column + static_cast<int>(type.getTypeName().size()),
+                                 NodePosition::Kind::TYPE, node});
+        }
+    }
+}
 
 struct LocalDefUseExtractor : public glslang::TIntermTraverser {
 public:
     glslang::TSourceLoc end_loc;
     std::vector<glslang::TIntermSymbol*> defs, uses;
-    std::map<int, std::vector<TIntermNode*>> nodes_by_line;
+    std::vector<NodePosition> node_positions;
     std::vector<glslang::TIntermSymbol*> userdef_types;
+    std::vector<glslang::TIntermAggregate*> calls;
 
     void visitConstantUnion(glslang::TIntermConstantUnion* node) override
     {
@@ -19,7 +59,6 @@ public:
         } else if (loc.line == end_loc.line && loc.column > end_loc.column) {
             end_loc = loc;
         }
-        nodes_by_line[node->getLoc().line].push_back(node);
     }
     bool visitBinary(glslang::TVisit, glslang::TIntermBinary* node) override
     {
@@ -30,7 +69,7 @@ public:
             end_loc = loc;
         }
 
-        nodes_by_line[node->getLoc().line].push_back(node);
+        add_node_position(node_positions, node);
         return true;
     }
     bool visitSelection(glslang::TVisit, glslang::TIntermSelection* node) override
@@ -42,7 +81,6 @@ public:
             end_loc = loc;
         }
 
-        nodes_by_line[node->getLoc().line].push_back(node);
         return true;
     }
     bool visitAggregate(glslang::TVisit, glslang::TIntermAggregate* node) override
@@ -54,7 +92,9 @@ public:
             end_loc = loc;
         }
 
-        nodes_by_line[node->getLoc().line].push_back(node);
+        if (node->getOp() == glslang::EOpFunctionCall) {
+            calls.push_back(node);
+        }
         return true;
     }
     bool visitLoop(glslang::TVisit, glslang::TIntermLoop* node) override
@@ -66,7 +106,6 @@ public:
             end_loc = loc;
         }
 
-        nodes_by_line[node->getLoc().line].push_back(node);
         return true;
     }
     bool visitBranch(glslang::TVisit, glslang::TIntermBranch* node) override
@@ -78,7 +117,6 @@ public:
             end_loc = loc;
         }
 
-        nodes_by_line[node->getLoc().line].push_back(node);
         return true;
     }
     bool visitSwitch(glslang::TVisit, glslang::TIntermSwitch* node) override
@@ -90,7 +128,6 @@ public:
             end_loc = loc;
         }
 
-        nodes_by_line[node->getLoc().line].push_back(node);
         return true;
     }
 
@@ -103,13 +140,13 @@ public:
             end_loc = loc;
         }
 
-        nodes_by_line[symbol->getLoc().line].push_back(symbol);
+        add_node_position(node_positions, symbol);
         uses.push_back(symbol);
     }
     bool visitUnary(glslang::TVisit v, glslang::TIntermUnary* unary) override
     {
         (void)v;
-        nodes_by_line[unary->getLoc().line].push_back(unary);
+        add_node_position(node_positions, unary);
         auto loc = unary->getLoc();
         if (loc.line > end_loc.line) {
             end_loc = loc;
@@ -140,10 +177,11 @@ public:
         std::vector<glslang::TIntermSymbol*> local_defs;
         std::vector<glslang::TIntermSymbol*> local_uses;
         std::vector<glslang::TIntermSymbol*> userdef_types;
+        std::vector<glslang::TIntermAggregate*> calls;
         glslang::TSourceLoc start, end;
     };
 
-    std::map<int, std::vector<TIntermNode*>> nodes_by_line;
+    std::vector<NodePosition> node_positions;
     std::vector<glslang::TIntermSymbol*> uses;
     std::vector<glslang::TIntermSymbol*> globals;
     std::vector<FunctionDefDesc> funcs;
@@ -152,7 +190,7 @@ public:
     {
         if (node->getOp() == glslang::EOpIndexDirectStruct || node->getOp() == glslang::EOpIndexDirect ||
             node->getOp() == glslang::EOpIndexIndirect) {
-            nodes_by_line[node->getLoc().line].push_back(node);
+            add_node_position(node_positions, node);
         }
         return true;
     }
@@ -184,7 +222,7 @@ public:
         if (agg->getOp() == glslang::EOpFunction) {
 
             struct FunctionDefDesc function_def = {
-                norm_func_name(agg->getName().c_str()), agg, {}, {}, {}, {}, agg->getLoc(), agg->getEndLoc()};
+                norm_func_name(agg->getName().c_str()), agg, {}, {}, {}, {}, {}, agg->getLoc(), agg->getEndLoc()};
 
             auto& children = agg->getSequence();
             if (children.size() != 2) {
@@ -210,17 +248,12 @@ public:
             function_def.local_defs.swap(extractor.defs);
             function_def.local_uses.swap(extractor.uses);
             function_def.userdef_types.swap(extractor.userdef_types);
-
-            fprintf(stderr, "found func def %s at %s:%d:%d to %d return type: %s has %zu sub nodes\n",
-                    agg->getName().c_str(), agg->getLoc().getFilename(), agg->getLoc().line, agg->getLoc().column,
-                    body->getAsAggregate()->getEndLoc().line, agg->getType().getCompleteString().c_str(),
-                    agg->getSequence().size());
+            function_def.calls.swap(extractor.calls);
 
             function_def.end = body->getAsAggregate()->getEndLoc();
             funcs.emplace_back(std::move(function_def));
-            for (auto [line, node] : extractor.nodes_by_line) {
-                nodes_by_line[line] = node;
-            }
+            node_positions.insert(node_positions.end(), extractor.node_positions.begin(),
+                                  extractor.node_positions.end());
             return false;
         }
 
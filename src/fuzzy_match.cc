@@ -0,0 +1,101 @@
+#include "fuzzy_match.hpp"
+#include <algorithm>
+
+static inline char to_lower(char c) { return (c >= 'A' && c <= 'Z') ? c - 'A' + 'a' : c; }
+static inline bool is_upper(char c) { return c >= 'A' && c <= 'Z'; }
+static inline bool is_lower(char c) { return c >= 'a' && c <= 'z'; }
+
+FuzzyMatcher::FuzzyMatcher(std::string_view pattern) : pattern_(pattern), mask_(char_mask(pattern))
+{
+    lower_.resize(pattern_.size());
+    std::transform(pattern_.begin(), pattern_.end(), lower_.begin(), to_lower);
+}
+
+uint64_t FuzzyMatcher::char_mask(std::string_view s)
+{
+    uint64_t mask = 0;
+    for (char c : s) {
+        c = to_lower(c);
+        if (c >= 'a' && c <= 'z') {
+            mask |= 1ULL << (c - 'a');
+        } else if (c >= '0' && c <= '9') {
+            mask |= 1ULL << (26 + c - '0');
+        } else if (c == '_') {
+            mask |= 1ULL << 36;
+        } else {
+            mask |= 1ULL << 37;
+        }
+    }
+    return mask;
+}
+
+int FuzzyMatcher::score(std::string_view word) const
+{
+    if (lower_.empty()) {
+        return 0;
+    }
+
+    if (word.size() < lower_.size() || (mask_ & ~char_mask(word)) != 0) {
+        return -1;
+    }
+
+    int score = 0;
+    size_t p = 0;
+    size_t prev = std::string_view::npos;
+    for (size_t i = 0; i < word.size() && p < lower_.size(); ++i) {
+        if (to_lower(word[i]) != lower_[p]) {
+            continue;
+        }
+
+        int s = 1;
+        if (i == 0) {
+            s += 8;
+        } else if (word[i - 1] == '_' || (is_lower(word[i - 1]) && is_upper(word[i]))) {
+            s += 6;
+        }
+        if (prev != std::string_view::npos && prev + 1 == i) {
+            s += 4;
+        }
+        if (word[i] == pattern_[p]) {
+            s += 1;
+        }
+
+        score += s;
+        prev = i;
+        ++p;
+    }
+
+    if (p < lower_.size()) {
+        return -1;
+    }
+
+    // among equal matches the shorter word is closer to what was typed
+    return score * 64 - static_cast<int>(std::min<size_t>(word.size() - lower_.size(), 63));
+}
+
+static bool worse(TopK::Item const& lhs, TopK::Item const& rhs)
+{
+    return lhs.score < rhs.score || (lhs.score == rhs.score && lhs.key > rhs.key);
+}
+
+void TopK::push(Item const& item)
+{
+    // std heap functions keep the largest on top, invert to keep the worst on top
+    auto cmp = [](Item const& lhs, Item const& rhs) { return worse(rhs, lhs); };
+    if (heap_.size() < k_) {
+        heap_.push_back(item);
+        std::push_heap(heap_.begin(), heap_.end(), cmp);
+    } else if (k_ > 0 && worse(heap_.front(), item)) {
+        std::pop_heap(heap_.begin(), heap_.end(), cmp);
+        heap_.back() = item;
+        std::push_heap(heap_.begin(), heap_.end(), cmp);
+    }
+}
+
+std::vector<TopK::Item> TopK::take()
+{
+    std::vector<Item> items;
+    items.swap(heap_);
+    std::sort(items.begin(), items.end(), [](Item const& lhs, Item const& rhs) { return worse(rhs, lhs); });
+    return items;
+}
@@ -0,0 +1,46 @@
+#ifndef __GLSLX_FUZZY_MATCH_HPP__
+#define __GLSLX_FUZZY_MATCH_HPP__
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// case-insensitive subsequence matching for completion. a match scores higher the more of the
+// pattern hits the start of the word, word boundaries (_ or camelCase) and consecutive characters.
+class FuzzyMatcher {
+public:
+    explicit FuzzyMatcher(std::string_view pattern);
+
+    // -1 if pattern is not a subsequence of word
+    int score(std::string_view word) const;
+
+    // set of characters in s, a word lacking a character of the pattern is rejected without a scan
+    static uint64_t char_mask(std::string_view s);
+
+private:
+    std::string pattern_;
+    std::string lower_;
+    uint64_t mask_;
+};
+
+// the k highest scored of the items pushed, in descending order of score then ascending key
+class TopK {
+public:
+    struct Item {
+        int score;
+        // tie breaker, smaller is better
+        uint64_t key;
+        size_t index;
+    };
+
+    explicit TopK(size_t k) : k_(k) {}
+
+    void push(Item const& item);
+    std::vector<Item> take();
+
+private:
+    size_t k_;
+    // min-heap on (score, -key), the worst kept item on top
+    std::vector<Item> heap_;
+};
+#endif
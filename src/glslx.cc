@@ -1,54 +1,68 @@
+#include "message_reader.hpp"
 #include "protocol.hpp"
+#include "stats.hpp"
+#include <condition_variable>
 #include <cstdio>
-#include <iostream>
-#include <vector>
+#include <deque>
+#include <mutex>
+#include <thread>
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#endif
 
-int read_message(std::string& body)
-{
-    char c;
-    std::string line;
-    while (std::cin.get(c)) {
-        line.push_back(c);
-        if (line.find("\r\n\r\n") != std::string::npos) {
-            break;
-        }
-    }
+// messages read from the client but not handled yet. $/cancelRequest never enters the
+// queue, it marks the queued request it refers to instead.
+class MessageQueue {
+public:
+    struct Message {
+        nlohmann::json body;
+        bool cancelled = false;
+    };
 
-    auto start_pos = line.find("Content-Length: ");
+    void push(nlohmann::json&& body)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (body.contains("method") && body["method"] == "$/cancelRequest") {
+            auto const& id = body["params"]["id"];
+            for (auto& message : messages_) {
+                if (message.body.contains("id") && message.body["id"] == id) {
+                    message.cancelled = true;
+                }
+            }
+            return;
+        }
 
-    if (start_pos == std::string::npos) {
-        fprintf(stderr, "format error: %s\n", line.c_str());
-        return -1;
+        messages_.push_back({std::move(body), false});
+        cv_.notify_one();
     }
 
-    auto end_pos = line.find("\r\n\r\n");
-    std::string content_length(line.begin() + start_pos, line.begin() + end_pos);
+    bool pop(Message& message)
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        cv_.wait(lock, [this]() { return !messages_.empty() || closed_; });
+        if (messages_.empty()) {
+            return false;
+        }
 
-    auto length_offset = content_length.find(": ");
-    std::string num(content_length.begin() + length_offset + 2, content_length.end());
-    auto len = ::atoi(num.c_str());
+        message = std::move(messages_.front());
+        messages_.pop_front();
+        return true;
+    }
 
-    std::vector<char> buf(len);
-    auto* p = buf.data();
-    int n = 0;
-    int total_len = len;
-    while ((n = fread(p, 1, total_len, stdin)) > 0) {
-        total_len -= n;
-        p += n;
-        if (total_len <= 0)
-            break;
+    void close()
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        closed_ = true;
+        cv_.notify_one();
     }
 
-    body = std::string(buf.begin(), buf.end());
-    return 0;
-}
-
-static void handle_message(std::string const& body)
-{
-    static Protocol protocol;
-    auto json = nlohmann::json::parse(body);
-    protocol.handle(json);
-}
+private:
+    std::deque<Message> messages_;
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    bool closed_ = false;
+};
 
 int main(int argc, char* argv[])
 {
@@ -56,11 +70,38 @@ int main(int argc, char* argv[])
     // if (fp) {
     //     stderr = fp;
     // }
-    std::string body;
-    while (read_message(body) == 0) {
-        handle_message(body);
-        body.clear();
-    };
+    static Protocol protocol;
+    MessageQueue queue;
+
+#ifdef _WIN32
+    _setmode(_fileno(stdin), _O_BINARY);
+    _setmode(_fileno(stdout), _O_BINARY);
+#endif
+
+    std::thread reader([&queue]() {
+        MessageReader message_reader(0);
+        std::string_view body;
+        while (message_reader.next(body)) {
+            auto json = nlohmann::json::parse(body.begin(), body.end(), nullptr, false);
+            if (json.is_discarded()) {
+                fprintf(stderr, "invalid message: %.*s\n", (int)body.size(), body.data());
+            } else {
+                queue.push(std::move(json));
+            }
+        }
+        queue.close();
+    });
+
+    MessageQueue::Message message;
+    while (queue.pop(message)) {
+        if (message.cancelled) {
+            protocol.cancel(message.body);
+        } else {
+            protocol.handle(message.body);
+        }
+    }
 
+    reader.join();
+    Stats::get().dump(stderr);
     return 0;
 }
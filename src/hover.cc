@@ -0,0 +1,43 @@
+#include "hover.hpp"
+#include <string>
+
+static Range name_range(DocIR::Occurrence const& occurrence)
+{
+    Range range;
+    range.start.line = occurrence.line - 1;
+    range.start.character = occurrence.column - 1;
+    range.end.line = range.start.line;
+    range.end.character = occurrence.end_column - 1;
+    return range;
+}
+
+bool hover(Doc& doc, const int line, const int col, Hover& result)
+{
+    auto const* ir = doc.ir();
+    if (!ir) {
+        return false;
+    }
+
+    for (auto const& occurrence : ir->lookup(line, col)) {
+        if (occurrence.kind == DocIR::Occurrence::Kind::SYMBOL) {
+            auto const& symbol = ir->symbols()[occurrence.target];
+            auto const& name = ir->str(symbol.name);
+            auto const& type = ir->str(symbol.type);
+            // a block without instance name, its type says everything
+            if (name.compare(0, 5, "anon@") == 0) {
+                result = {type, false, {}};
+            } else {
+                result = {type + " " + name, true, name_range(occurrence)};
+            }
+            return true;
+        } else if (occurrence.kind == DocIR::Occurrence::Kind::FIELD) {
+            auto const& field = ir->fields()[occurrence.target];
+            result = {ir->str(field.type) + " " + ir->str(field.name), false, {}};
+            return true;
+        } else if (occurrence.kind == DocIR::Occurrence::Kind::TYPE) {
+            result = {ir->str(ir->structs()[occurrence.target].type), false, {}};
+            return true;
+        }
+    }
+    return false;
+}
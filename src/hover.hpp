@@ -0,0 +1,10 @@
+#ifndef __GLSLX_HOVER_HPP__
+#define __GLSLX_HOVER_HPP__
+
+#include "doc.hpp"
+#include "lsp_defs.hpp"
+
+// the declaration of the symbol, field or type at line:col, 1-based like the AST. answered from
+// Doc::ir()
+extern bool hover(Doc& doc, const int line, const int col, Hover& result);
+#endif
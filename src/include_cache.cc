@@ -0,0 +1,126 @@
+#include "include_cache.hpp"
+#include "preprocess.hpp"
+#include "stats.hpp"
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+#include <system_error>
+
+IncludeCache& IncludeCache::get()
+{
+    static IncludeCache cache;
+    return cache;
+}
+
+std::string IncludeCache::normalize(std::string const& path)
+{
+    return std::filesystem::path(path).lexically_normal().string();
+}
+
+static const std::string kFileScheme = "file://";
+
+std::string uri_to_path(std::string const& uri)
+{
+    if (uri.compare(0, kFileScheme.size(), kFileScheme) == 0) {
+        return IncludeCache::normalize(uri.substr(kFileScheme.size()));
+    }
+
+    return IncludeCache::normalize(uri);
+}
+
+std::string path_to_uri(std::string const& path)
+{
+    if (path.compare(0, kFileScheme.size(), kFileScheme) == 0) {
+        return path;
+    }
+
+    return kFileScheme + path;
+}
+
+std::shared_ptr<const IncludeCache::File> IncludeCache::load(std::string const& path)
+{
+    auto key = normalize(path);
+    std::error_code ec;
+    auto mtime = std::filesystem::last_write_time(key, ec);
+
+    static auto& cache_stats = Stats::get().cache("include");
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto pos = files_.find(key);
+    bool hit = pos != files_.end() && (pos->second->overlay || (!ec && pos->second->mtime == mtime));
+    cache_stats.access(hit);
+    if (hit) {
+        return pos->second;
+    }
+
+    std::ifstream ifs(key, std::ios::binary);
+    if (ec || !ifs) {
+        files_.erase(key);
+        return nullptr;
+    }
+
+    auto file = std::make_shared<File>();
+    file->content.assign(std::istreambuf_iterator<char>(ifs), std::istreambuf_iterator<char>());
+    file->hash = stable_hash(file->content);
+    file->mtime = mtime;
+    file->overlay = false;
+
+    files_[key] = file;
+    return file;
+}
+
+uint64_t IncludeCache::hash(std::string const& path)
+{
+    auto file = load(path);
+    return file ? file->hash : 0;
+}
+
+void IncludeCache::update(std::string const& path, std::string const& text)
+{
+    auto key = normalize(path);
+    auto file = std::make_shared<File>();
+    file->content = text;
+    file->hash = stable_hash(text);
+    file->overlay = true;
+
+    // a header nothing included yet is served from the buffer too once something does
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto& cached = files_[key];
+    if (cached) {
+        file->mtime = cached->mtime;
+    }
+    cached = file;
+}
+
+void IncludeCache::invalidate(std::string const& path)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    files_.erase(normalize(path));
+}
+
+glslang::TShader::Includer::IncludeResult*
+CachedFileIncluder::newIncludeResult(const std::string& path, std::ifstream& file, int length) const
+{
+    auto cached = IncludeCache::get().load(path);
+    if (!cached) {
+        // could not be cached, serve what the includer already opened
+        auto uncached = std::make_shared<IncludeCache::File>();
+        file.seekg(0, file.beg);
+        uncached->content.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+        uncached->hash = stable_hash(uncached->content);
+        uncached->overlay = false;
+        cached = uncached;
+    }
+
+    // the result keeps the cached file alive until glslang releases it
+    auto* holder = new std::shared_ptr<const IncludeCache::File>(cached);
+    return new IncludeResult(path, cached->content.data(), cached->content.size(), holder);
+}
+
+void CachedFileIncluder::releaseInclude(IncludeResult* result)
+{
+    if (!result)
+        return;
+
+    delete static_cast<std::shared_ptr<const IncludeCache::File>*>(result->userData);
+    delete result;
+}
@@ -0,0 +1,53 @@
+#ifndef __GLSLX_INCLUDE_CACHE_HPP__
+#define __GLSLX_INCLUDE_CACHE_HPP__
+#include "StandAlone/DirStackFileIncluder.h"
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+// contents of #include'd headers shared by every Doc, the parse worker and the preprocessor pass.
+// a cached file is reused while its mtime is unchanged. a header open in the editor is served from
+// its buffer until it is saved.
+class IncludeCache {
+public:
+    struct File {
+        std::string content;
+        uint64_t hash;
+        std::filesystem::file_time_type mtime;
+        bool overlay;
+    };
+
+    static IncludeCache& get();
+    static std::string normalize(std::string const& path);
+
+    std::shared_ptr<const File> load(std::string const& path);
+    // hash of what load() returns now, 0 if the file can not be read
+    uint64_t hash(std::string const& path);
+
+    // serve the editor buffer of an open document instead of the file until it is invalidated
+    void update(std::string const& path, std::string const& text);
+    // forget the cached content, the next load reads the disk again
+    void invalidate(std::string const& path);
+
+private:
+    std::mutex mutex_;
+    std::unordered_map<std::string, std::shared_ptr<const File>> files_;
+};
+
+// normalized path of a file:// uri, or of a path glslang reports for a header
+std::string uri_to_path(std::string const& uri);
+// file:// uri of a header path glslang reports, uris are returned as they are
+std::string path_to_uri(std::string const& path);
+
+// DirStackFileIncluder resolving headers as usual but reading them through IncludeCache
+class CachedFileIncluder : public DirStackFileIncluder {
+public:
+    void releaseInclude(IncludeResult* result) override;
+
+protected:
+    IncludeResult* newIncludeResult(const std::string& path, std::ifstream& file, int length) const override;
+};
+#endif
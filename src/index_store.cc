@@ -0,0 +1,360 @@
+#include "index_store.hpp"
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <system_error>
+#include <unordered_map>
+#if !defined(_WIN32)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace {
+struct StrRef {
+    uint32_t offset;
+    uint32_t size;
+};
+
+struct Header {
+    char magic[8];
+    uint32_t version;
+    uint32_t file_count;
+    uint32_t include_count;
+    uint32_t symbol_count;
+    uint32_t inactive_count;
+    uint32_t ref_count;
+    uint64_t strings_size;
+};
+
+struct FileRecord {
+    StrRef uri;
+    uint64_t hash;
+    uint64_t option_hash;
+    uint32_t first_include;
+    uint32_t include_count;
+    uint32_t first_symbol;
+    uint32_t symbol_count;
+    uint32_t first_ref;
+    uint32_t ref_count;
+    uint32_t first_inactive;
+    uint32_t inactive_count;
+};
+
+struct IncludeRecord {
+    StrRef path;
+    uint64_t hash;
+};
+
+struct SymbolRecord {
+    StrRef name;
+    StrRef detail;
+    StrRef file;
+    int32_t line;
+    int32_t column;
+    int32_t end_line;
+    int32_t end_column;
+    uint32_t kind;
+};
+
+struct RefRecord {
+    StrRef name;
+    StrRef decl_file;
+    StrRef file;
+    int32_t decl_line;
+    int32_t decl_column;
+    int32_t line;
+    int32_t column;
+};
+
+struct InactiveRecord {
+    int32_t start;
+    int32_t end;
+};
+
+static_assert(sizeof(Header) == 40, "unexpected Header layout");
+static_assert(sizeof(FileRecord) == 56, "unexpected FileRecord layout");
+static_assert(sizeof(IncludeRecord) == 16, "unexpected IncludeRecord layout");
+static_assert(sizeof(SymbolRecord) == 44, "unexpected SymbolRecord layout");
+static_assert(sizeof(RefRecord) == 40, "unexpected RefRecord layout");
+static_assert(sizeof(InactiveRecord) == 8, "unexpected InactiveRecord layout");
+
+const char kMagic[8] = {'G', 'L', 'S', 'L', 'X', 'I', 'D', 'X'};
+
+// read-only view of a whole file, mapped where the platform allows it
+class MappedFile {
+public:
+    explicit MappedFile(std::string const& path)
+    {
+#if defined(_WIN32)
+        std::ifstream ifs(path, std::ios::binary | std::ios::ate);
+        if (!ifs) {
+            return;
+        }
+
+        size_ = static_cast<size_t>(ifs.tellg());
+        // uint64_t storage keeps the records aligned
+        buffer_.reset(new uint64_t[(size_ + sizeof(uint64_t) - 1) / sizeof(uint64_t)]);
+        ifs.seekg(0);
+        if (!ifs.read(reinterpret_cast<char*>(buffer_.get()), size_)) {
+            size_ = 0;
+            return;
+        }
+        data_ = reinterpret_cast<const char*>(buffer_.get());
+#else
+        int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            return;
+        }
+
+        struct stat st;
+        if (fstat(fd, &st) == 0 && st.st_size > 0) {
+            void* addr = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (addr != MAP_FAILED) {
+                data_ = static_cast<const char*>(addr);
+                size_ = st.st_size;
+            }
+        }
+        close(fd);
+#endif
+    }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    ~MappedFile()
+    {
+#if !defined(_WIN32)
+        if (data_) {
+            munmap(const_cast<char*>(data_), size_);
+        }
+#endif
+    }
+
+    const char* data() const { return data_; }
+    size_t size() const { return size_; }
+
+private:
+    const char* data_ = nullptr;
+    size_t size_ = 0;
+#if defined(_WIN32)
+    std::unique_ptr<uint64_t[]> buffer_;
+#endif
+};
+
+class StringTable {
+public:
+    // names and file names repeat a lot, each distinct string is stored once
+    StrRef add(std::string const& s)
+    {
+        auto pos = refs_.find(s);
+        if (pos != refs_.end()) {
+            return pos->second;
+        }
+
+        StrRef ref = {static_cast<uint32_t>(data_.size()), static_cast<uint32_t>(s.size())};
+        data_ += s;
+        refs_.emplace(s, ref);
+        return ref;
+    }
+
+    std::string const& data() const { return data_; }
+
+private:
+    std::string data_;
+    std::unordered_map<std::string, StrRef> refs_;
+};
+} // namespace
+
+template <typename T> static void write_records(std::ofstream& ofs, std::vector<T> const& records)
+{
+    ofs.write(reinterpret_cast<const char*>(records.data()), records.size() * sizeof(T));
+}
+
+bool save_index_store(std::string const& path, std::vector<std::shared_ptr<const FileIndex>> const& files)
+{
+    namespace fs = std::filesystem;
+
+    StringTable strings;
+    std::vector<FileRecord> file_records;
+    std::vector<IncludeRecord> include_records;
+    std::vector<SymbolRecord> symbol_records;
+    std::vector<RefRecord> ref_records;
+    std::vector<InactiveRecord> inactive_records;
+
+    file_records.reserve(files.size());
+    for (auto const& file : files) {
+        FileRecord record = {strings.add(file->uri), file->hash, file->option_hash};
+        record.first_include = include_records.size();
+        record.include_count = file->includes.size();
+        for (auto const& [include, hash] : file->includes) {
+            include_records.push_back({strings.add(include), hash});
+        }
+
+        record.first_symbol = symbol_records.size();
+        record.symbol_count = file->symbols.size();
+        for (auto const& symbol : file->symbols) {
+            symbol_records.push_back({strings.add(symbol.name), strings.add(symbol.detail), strings.add(symbol.file),
+                                      symbol.line, symbol.column, symbol.end_line, symbol.end_column,
+                                      static_cast<uint32_t>(symbol.kind)});
+        }
+
+        record.first_ref = ref_records.size();
+        record.ref_count = file->refs.size();
+        for (auto const& ref : file->refs) {
+            ref_records.push_back({strings.add(ref.name), strings.add(ref.decl_file), strings.add(ref.file),
+                                   ref.decl_line, ref.decl_column, ref.line, ref.column});
+        }
+
+        record.first_inactive = inactive_records.size();
+        record.inactive_count = file->inactive_blocks.size();
+        for (auto const& block : file->inactive_blocks) {
+            inactive_records.push_back({block.start, block.end});
+        }
+
+        file_records.push_back(record);
+    }
+
+    Header header;
+    memcpy(header.magic, kMagic, sizeof(kMagic));
+    header.version = kIndexStoreVersion;
+    header.file_count = file_records.size();
+    header.include_count = include_records.size();
+    header.symbol_count = symbol_records.size();
+    header.inactive_count = inactive_records.size();
+    header.ref_count = ref_records.size();
+    header.strings_size = strings.data().size();
+
+    std::error_code ec;
+    fs::create_directories(fs::path(path).parent_path(), ec);
+
+    // written aside and renamed, a concurrent reader never sees half a file
+    std::string tmp = path + ".tmp";
+    {
+        std::ofstream ofs(tmp, std::ios::binary | std::ios::trunc);
+        if (!ofs) {
+            fprintf(stderr, "index: failed to write %s\n", tmp.c_str());
+            return false;
+        }
+
+        ofs.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        write_records(ofs, file_records);
+        write_records(ofs, include_records);
+        write_records(ofs, symbol_records);
+        write_records(ofs, ref_records);
+        write_records(ofs, inactive_records);
+        ofs.write(strings.data().data(), strings.data().size());
+        if (!ofs) {
+            fprintf(stderr, "index: failed to write %s\n", tmp.c_str());
+            return false;
+        }
+    }
+
+    fs::rename(tmp, path, ec);
+    if (ec) {
+        fprintf(stderr, "index: failed to rename %s: %s\n", tmp.c_str(), ec.message().c_str());
+        fs::remove(tmp, ec);
+        return false;
+    }
+
+    return true;
+}
+
+bool load_index_store(std::string const& path, std::vector<FileIndex>& files)
+{
+    MappedFile mapped(path);
+    if (!mapped.data() || mapped.size() < sizeof(Header)) {
+        return false;
+    }
+
+    auto const* header = reinterpret_cast<const Header*>(mapped.data());
+    if (memcmp(header->magic, kMagic, sizeof(kMagic)) != 0 || header->version != kIndexStoreVersion) {
+        return false;
+    }
+
+    uint64_t expected = sizeof(Header) + uint64_t(header->file_count) * sizeof(FileRecord) +
+                        uint64_t(header->include_count) * sizeof(IncludeRecord) +
+                        uint64_t(header->symbol_count) * sizeof(SymbolRecord) +
+                        uint64_t(header->ref_count) * sizeof(RefRecord) +
+                        uint64_t(header->inactive_count) * sizeof(InactiveRecord) + header->strings_size;
+    if (expected != mapped.size()) {
+        fprintf(stderr, "index: ignoring truncated %s\n", path.c_str());
+        return false;
+    }
+
+    auto const* file_records = reinterpret_cast<const FileRecord*>(header + 1);
+    auto const* include_records = reinterpret_cast<const IncludeRecord*>(file_records + header->file_count);
+    auto const* symbol_records = reinterpret_cast<const SymbolRecord*>(include_records + header->include_count);
+    auto const* ref_records = reinterpret_cast<const RefRecord*>(symbol_records + header->symbol_count);
+    auto const* inactive_records = reinterpret_cast<const InactiveRecord*>(ref_records + header->ref_count);
+    const char* strings = reinterpret_cast<const char*>(inactive_records + header->inactive_count);
+
+    bool valid = true;
+    auto str = [strings, header, &valid](StrRef ref) {
+        if (uint64_t(ref.offset) + ref.size > header->strings_size) {
+            valid = false;
+            return std::string();
+        }
+        return std::string(strings + ref.offset, ref.size);
+    };
+    auto in_range = [](uint32_t first, uint32_t count, uint32_t total) { return uint64_t(first) + count <= total; };
+
+    std::vector<FileIndex> loaded;
+    loaded.reserve(header->file_count);
+    for (uint32_t i = 0; i < header->file_count && valid; ++i) {
+        auto const& record = file_records[i];
+        if (!in_range(record.first_include, record.include_count, header->include_count) ||
+            !in_range(record.first_symbol, record.symbol_count, header->symbol_count) ||
+            !in_range(record.first_ref, record.ref_count, header->ref_count) ||
+            !in_range(record.first_inactive, record.inactive_count, header->inactive_count)) {
+            valid = false;
+            break;
+        }
+
+        FileIndex file;
+        file.uri = str(record.uri);
+        file.hash = record.hash;
+        file.option_hash = record.option_hash;
+
+        for (uint32_t j = 0; j < record.include_count; ++j) {
+            auto const& include = include_records[record.first_include + j];
+            file.includes.emplace_back(str(include.path), include.hash);
+        }
+
+        file.symbols.reserve(record.symbol_count);
+        for (uint32_t j = 0; j < record.symbol_count; ++j) {
+            auto const& symbol = symbol_records[record.first_symbol + j];
+            if (symbol.kind > static_cast<uint32_t>(IndexSymbol::Kind::Struct)) {
+                valid = false;
+                break;
+            }
+            file.symbols.push_back({static_cast<IndexSymbol::Kind>(symbol.kind), str(symbol.name), str(symbol.detail),
+                                    str(symbol.file), symbol.line, symbol.column, symbol.end_line,
+                                    symbol.end_column});
+        }
+
+        file.refs.reserve(record.ref_count);
+        for (uint32_t j = 0; j < record.ref_count; ++j) {
+            auto const& ref = ref_records[record.first_ref + j];
+            file.refs.push_back({str(ref.name), str(ref.decl_file), ref.decl_line, ref.decl_column, str(ref.file),
+                                 ref.line, ref.column});
+        }
+
+        for (uint32_t j = 0; j < record.inactive_count; ++j) {
+            auto const& block = inactive_records[record.first_inactive + j];
+            file.inactive_blocks.push_back({block.start, block.end});
+        }
+
+        loaded.push_back(std::move(file));
+    }
+
+    if (!valid) {
+        fprintf(stderr, "index: ignoring corrupted %s\n", path.c_str());
+        return false;
+    }
+
+    files.swap(loaded);
+    return true;
+}
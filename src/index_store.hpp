@@ -0,0 +1,24 @@
+#ifndef __GLSLX_INDEX_STORE_HPP__
+#define __GLSLX_INDEX_STORE_HPP__
+#include "workspace_index.hpp"
+#include <memory>
+#include <string>
+#include <vector>
+
+// the workspace index persisted as one binary file, <root>/.glslx/index.bin.
+//
+// layout, native endianness, every section aligned to its record:
+//   Header
+//   FileRecord[file_count]
+//   IncludeRecord[include_count]
+//   SymbolRecord[symbol_count]
+//   RefRecord[ref_count]
+//   InactiveRecord[inactive_count]
+//   char strings[strings_size]
+// strings are referenced by offset and size into the string section. the file is mapped read-only
+// and decoded in one pass, a file with another magic, version or size is ignored.
+constexpr uint32_t kIndexStoreVersion = 2;
+
+extern bool save_index_store(std::string const& path, std::vector<std::shared_ptr<const FileIndex>> const& files);
+extern bool load_index_store(std::string const& path, std::vector<FileIndex>& files);
+#endif
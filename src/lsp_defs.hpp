@@ -2,7 +2,11 @@
 #define __GLSLX_LSP_DEFS_HPP__
 
 #include "nlohmann/json.hpp"
+#include <algorithm>
+#include <cstdint>
+#include <memory>
 #include <string>
+#include <string_view>
 #include <vector>
 
 enum class SymbolKind {
@@ -54,6 +58,92 @@ struct Range {
     }
 };
 
+struct Location {
+    std::string uri;
+    Range range;
+
+    inline nlohmann::json json() const
+    {
+        nlohmann::json location;
+        location["uri"] = uri;
+        location["range"] = range.json();
+        return location;
+    }
+};
+
+enum class DiagnosticSeverity {
+    Error = 1,
+    Warning = 2,
+    Information = 3,
+    Hint = 4,
+};
+
+struct Diagnostic {
+    std::string uri;
+    Range range;
+    DiagnosticSeverity severity;
+    std::string message;
+
+    inline nlohmann::json json() const
+    {
+        nlohmann::json diagnostic;
+        diagnostic["range"] = range.json();
+        diagnostic["severity"] = int(severity);
+        diagnostic["source"] = "glslx";
+        diagnostic["message"] = message;
+        return diagnostic;
+    }
+};
+
+// what Position.character counts, utf-16 code units unless utf-8 was negotiated in initialize
+enum class PositionEncoding { UTF16, UTF8 };
+
+// bytes of the utf-8 sequence starting with lead
+inline int utf8_length(unsigned char lead) { return lead < 0x80 ? 1 : lead < 0xe0 ? 2 : lead < 0xf0 ? 3 : 4; }
+
+// byte offset in a utf-8 line of a Position.character, clamped to the line
+inline int utf8_column(std::string_view line, const int character, PositionEncoding encoding)
+{
+    if (encoding == PositionEncoding::UTF8) {
+        return std::clamp(character, 0, (int)line.size());
+    }
+
+    int units = 0;
+    size_t i = 0;
+    while (i < line.size() && units < character) {
+        const int len = utf8_length(static_cast<unsigned char>(line[i]));
+        // code points beyond the bmp are a surrogate pair
+        units += len == 4 ? 2 : 1;
+        i = std::min(i + len, line.size());
+    }
+    return (int)i;
+}
+
+// Position.character of a byte offset in a utf-8 line, bytes past the end of the line count one each
+inline int client_column(std::string_view line, const int byte, PositionEncoding encoding)
+{
+    if (encoding == PositionEncoding::UTF8 || byte <= 0) {
+        return byte;
+    }
+
+    const size_t end = std::min((size_t)byte, line.size());
+    int units = 0;
+    size_t i = 0;
+    while (i < end) {
+        const int len = utf8_length(static_cast<unsigned char>(line[i]));
+        units += len == 4 ? 2 : 1;
+        i += len;
+    }
+    return byte > (int)line.size() ? units + byte - (int)line.size() : units;
+}
+
+struct TextDocumentContentChangeEvent {
+    // a change without range replaces the whole document
+    bool has_range;
+    Range range;
+    std::string text;
+};
+
 struct DocumentSymbol {
     std::string name;
     std::string detail;
@@ -79,6 +169,22 @@ struct DocumentSymbol {
     }
 };
 
+// workspace/symbol result
+struct SymbolInformation {
+    std::string name;
+    SymbolKind kind;
+    Location location;
+
+    inline nlohmann::json json() const
+    {
+        nlohmann::json symbol;
+        symbol["name"] = name;
+        symbol["kind"] = int(kind);
+        symbol["location"] = location.json();
+        return symbol;
+    }
+};
+
 enum class CompletionItemKind {
     Text = 1,
     Method = 2,
@@ -146,12 +252,54 @@ struct CompletionResult {
     }
 };
 
+namespace glslang {
+class TType;
+}
+
+struct Hover {
+    // glsl source shown in a code block
+    std::string code;
+    // hovers without range are shown at the cursor
+    bool has_range;
+    Range range;
+
+    inline nlohmann::json json() const
+    {
+        nlohmann::json hover;
+        hover["contents"] = {{"kind", "markdown"}, {"value", "```glsl\n" + code + "\n```"}};
+        if (has_range)
+            hover["range"] = range.json();
+        return hover;
+    }
+};
+
+// completion items are immutable and shared, built-ins, keywords and user functions are formatted
+// once and offered by every request. json is only serialized ahead for those, it is null otherwise.
+struct CompletionItem {
+    CompletionResult result;
+    nlohmann::json json;
+    // the printed type, a DocIR::StrId of the IR the items were collected from. detail is filled in
+    // from it on completionItem/resolve, 0 if detail is set already
+    uint32_t type = 0;
+};
+
+using CompletionItemPtr = std::shared_ptr<const CompletionItem>;
+
+inline CompletionItemPtr make_completion_item(CompletionResult result, bool serialize = false)
+{
+    auto item = std::make_shared<CompletionItem>();
+    item->result = std::move(result);
+    if (serialize)
+        item->json = item->result.json();
+    return item;
+}
+
 struct CompletionResultSet {
-    std::vector<CompletionResult> types;
-    std::vector<CompletionResult> funcs;
-    std::vector<CompletionResult> variables;
-    std::vector<CompletionResult> keywords;
-    std::vector<CompletionResult> builtins;
+    std::vector<CompletionItemPtr> types;
+    std::vector<CompletionItemPtr> funcs;
+    std::vector<CompletionItemPtr> variables;
+    std::vector<CompletionItemPtr> keywords;
+    std::vector<CompletionItemPtr> builtins;
 };
 
 #endif
@@ -0,0 +1,157 @@
+#include "message_reader.hpp"
+#include <cctype>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+static bool iequals(std::string_view lhs, std::string_view rhs)
+{
+    if (lhs.size() != rhs.size())
+        return false;
+
+    for (size_t i = 0; i < lhs.size(); ++i) {
+        if (std::tolower((unsigned char)lhs[i]) != std::tolower((unsigned char)rhs[i])) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static std::string_view trim(std::string_view s)
+{
+    while (!s.empty() && std::isspace((unsigned char)s.front())) {
+        s.remove_prefix(1);
+    }
+
+    while (!s.empty() && std::isspace((unsigned char)s.back())) {
+        s.remove_suffix(1);
+    }
+
+    return s;
+}
+
+MessageReader::MessageReader(int fd, size_t capacity) : fd_(fd), buf_(capacity) {}
+
+bool MessageReader::fill_()
+{
+    // drop consumed bytes before growing, the caller no longer needs the previous body
+    if (begin_ > 0) {
+        std::memmove(buf_.data(), buf_.data() + begin_, end_ - begin_);
+        end_ -= begin_;
+        scan_ -= begin_;
+        begin_ = 0;
+    }
+
+    if (end_ == buf_.size()) {
+        buf_.resize(buf_.size() * 2);
+    }
+
+    while (true) {
+#ifdef _WIN32
+        auto n = ::_read(fd_, buf_.data() + end_, (unsigned int)(buf_.size() - end_));
+#else
+        auto n = ::read(fd_, buf_.data() + end_, buf_.size() - end_);
+#endif
+        if (n > 0) {
+            end_ += n;
+            return true;
+        }
+
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+
+        return false;
+    }
+}
+
+bool MessageReader::parse_headers_(std::string_view headers, size_t& content_length)
+{
+    bool has_length = false;
+    while (!headers.empty()) {
+        auto eol = headers.find("\r\n");
+        auto line = headers.substr(0, eol);
+        headers.remove_prefix(eol == std::string_view::npos ? headers.size() : eol + 2);
+
+        auto colon = line.find(':');
+        if (colon == std::string_view::npos) {
+            continue;
+        }
+
+        auto key = trim(line.substr(0, colon));
+        auto value = trim(line.substr(colon + 1));
+
+        if (iequals(key, "Content-Length")) {
+            size_t len = 0;
+            for (auto c : value) {
+                if (!std::isdigit((unsigned char)c)) {
+                    return false;
+                }
+                len = len * 10 + (c - '0');
+            }
+            content_length = len;
+            has_length = !value.empty();
+        } else if (iequals(key, "Content-Type")) {
+            auto charset = value.find("charset=");
+            if (charset != std::string_view::npos) {
+                auto name = trim(value.substr(charset + 8));
+                if (!iequals(name, "utf-8") && !iequals(name, "utf8")) {
+                    fprintf(stderr, "unsupported charset: %.*s\n", (int)name.size(), name.data());
+                }
+            }
+        }
+    }
+
+    return has_length;
+}
+
+bool MessageReader::next(std::string_view& body)
+{
+    while (true) {
+        std::string_view pending(buf_.data() + scan_, end_ - scan_);
+        auto pos = pending.find("\r\n\r\n");
+        if (pos == std::string_view::npos) {
+            // the terminator may straddle two reads
+            scan_ = end_ - begin_ >= 3 ? end_ - 3 : begin_;
+            if (!fill_()) {
+                return false;
+            }
+            continue;
+        }
+
+        size_t header_end = scan_ + pos;
+        size_t body_start = header_end + 4;
+        std::string_view headers(buf_.data() + begin_, header_end - begin_);
+
+        size_t content_length = 0;
+        if (!parse_headers_(headers, content_length)) {
+            fprintf(stderr, "format error: %.*s\n", (int)headers.size(), headers.data());
+            begin_ = scan_ = body_start;
+            continue;
+        }
+
+        while (end_ - body_start < content_length) {
+            size_t offset = begin_;
+            size_t frame_size = body_start - begin_ + content_length;
+            if (buf_.size() < frame_size) {
+                buf_.resize(frame_size);
+            }
+
+            if (!fill_()) {
+                return false;
+            }
+            body_start -= offset;
+        }
+
+        body = std::string_view(buf_.data() + body_start, content_length);
+        begin_ = scan_ = body_start + content_length;
+        return true;
+    }
+}
@@ -0,0 +1,27 @@
+#ifndef __GLSLX_MESSAGE_READER_HPP__
+#define __GLSLX_MESSAGE_READER_HPP__
+#include <cstddef>
+#include <string_view>
+#include <vector>
+
+// reads LSP base protocol frames from a file descriptor with large reads into a reusable buffer.
+// headers are parsed in place and the body is handed out as a view into the buffer.
+class MessageReader {
+public:
+    explicit MessageReader(int fd, size_t capacity = 64 * 1024);
+
+    // the returned body stays valid until the next call. returns false on end of input.
+    bool next(std::string_view& body);
+
+private:
+    int fd_;
+    std::vector<char> buf_;
+    // unconsumed bytes are [begin_, end_), header scanning resumes at scan_
+    size_t begin_ = 0;
+    size_t end_ = 0;
+    size_t scan_ = 0;
+
+    bool fill_();
+    bool parse_headers_(std::string_view headers, size_t& content_length);
+};
+#endif
@@ -0,0 +1,137 @@
+#include "message_writer.hpp"
+#include "stats.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <cstdio>
+#include <cstring>
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <sys/uio.h>
+#include <unistd.h>
+#endif
+
+static constexpr char kHeaderFormat[] = "Content-Length: %zu\r\n"
+                                        "Content-Type: application/vscode-jsonrpc; charset=utf-8\r\n\r\n";
+
+#ifndef IOV_MAX
+#define IOV_MAX 1024
+#endif
+
+MessageWriter::MessageWriter(int fd) : fd_(fd)
+{
+    writer_ = std::thread([this]() { run_(); });
+}
+
+MessageWriter::~MessageWriter()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stop_ = true;
+    }
+
+    cv_.notify_all();
+    if (writer_.joinable()) {
+        writer_.join();
+    }
+}
+
+void MessageWriter::send(nlohmann::json const& message, bool flush)
+{
+    static auto& serialize_time = Stats::get().phase("serialize");
+    Frame frame;
+    {
+        ScopedTimer timer(serialize_time);
+        frame.body = message.dump();
+    }
+
+    // header and body go out as two iovecs, the body is never copied
+    char header[sizeof(kHeaderFormat) + 20];
+    int header_len = snprintf(header, sizeof(header), kHeaderFormat, frame.body.size());
+    frame.header.assign(header, header_len);
+
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        pending_.emplace_back(std::move(frame));
+        flush_ = flush_ || flush;
+    }
+
+    if (flush) {
+        cv_.notify_one();
+    }
+}
+
+void MessageWriter::run_()
+{
+    std::vector<Frame> frames;
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (true) {
+        cv_.wait(lock, [this]() { return flush_ || stop_; });
+        if (pending_.empty() && stop_) {
+            break;
+        }
+
+        frames.swap(pending_);
+        flush_ = false;
+        lock.unlock();
+
+        write_(frames);
+        frames.clear();
+
+        lock.lock();
+    }
+}
+
+void MessageWriter::write_(std::vector<Frame> const& frames)
+{
+#ifdef _WIN32
+    for (auto const& frame : frames) {
+        for (auto const* part : {&frame.header, &frame.body}) {
+            const char* p = part->data();
+            size_t left = part->size();
+            while (left > 0) {
+                auto n = ::_write(fd_, p, (unsigned int)left);
+                if (n <= 0) {
+                    fprintf(stderr, "write to client failed: %s\n", strerror(errno));
+                    return;
+                }
+                p += n;
+                left -= n;
+            }
+        }
+    }
+#else
+    std::vector<iovec> iovs;
+    iovs.reserve(frames.size() * 2);
+    for (auto const& frame : frames) {
+        iovs.push_back({const_cast<char*>(frame.header.data()), frame.header.size()});
+        iovs.push_back({const_cast<char*>(frame.body.data()), frame.body.size()});
+    }
+
+    size_t first = 0;
+    while (first < iovs.size()) {
+        int count = (int)std::min<size_t>(iovs.size() - first, IOV_MAX);
+        auto n = ::writev(fd_, iovs.data() + first, count);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            fprintf(stderr, "write to client failed: %s\n", strerror(errno));
+            return;
+        }
+
+        // skip what was written, a partial write leaves the rest of an iovec
+        size_t written = n;
+        while (first < iovs.size() && written >= iovs[first].iov_len) {
+            written -= iovs[first].iov_len;
+            ++first;
+        }
+
+        if (first < iovs.size()) {
+            iovs[first].iov_base = static_cast<char*>(iovs[first].iov_base) + written;
+            iovs[first].iov_len -= written;
+        }
+    }
+#endif
+}
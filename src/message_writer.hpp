@@ -0,0 +1,40 @@
+#ifndef __GLSLX_MESSAGE_WRITER_HPP__
+#define __GLSLX_MESSAGE_WRITER_HPP__
+#include "nlohmann/json.hpp"
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// frames and queues LSP messages, a writer thread drains the queue so callers never block on a slow client.
+// every message queued before a flush goes out with a single writev.
+class MessageWriter {
+public:
+    explicit MessageWriter(int fd);
+    MessageWriter(const MessageWriter&) = delete;
+    MessageWriter& operator=(const MessageWriter&) = delete;
+    ~MessageWriter();
+
+    // with flush = false the message waits for the next flushed one, so that messages emitted together are
+    // written together.
+    void send(nlohmann::json const& message, bool flush = true);
+
+private:
+    struct Frame {
+        std::string header;
+        std::string body;
+    };
+
+    int fd_;
+    std::vector<Frame> pending_;
+    bool flush_ = false;
+    bool stop_ = false;
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    std::thread writer_;
+
+    void run_();
+    void write_(std::vector<Frame> const& frames);
+};
+#endif
@@ -0,0 +1,82 @@
+#include "parse_scheduler.hpp"
+#include <cstdio>
+#include <utility>
+
+ParseScheduler::ParseScheduler(Callback on_parsed, Clock::duration debounce)
+    : on_parsed_(std::move(on_parsed)), debounce_(debounce)
+{
+    worker_ = std::thread([this]() { run_(); });
+}
+
+ParseScheduler::~ParseScheduler()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stop_ = true;
+        pending_.clear();
+    }
+
+    cv_.notify_all();
+    if (worker_.joinable()) {
+        worker_.join();
+    }
+}
+
+void ParseScheduler::schedule(std::string const& uri, const int version, std::string const& text,
+                              CompileOption const& option, bool immediate)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto pos = pending_.find(uri);
+        if (pos != pending_.end() && pos->second.version > version) {
+            return;
+        }
+
+        auto due = immediate ? Clock::now() : Clock::now() + debounce_;
+        pending_[uri] = Job{version, text, option, due};
+    }
+
+    cv_.notify_all();
+}
+
+void ParseScheduler::cancel(std::string const& uri)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    pending_.erase(uri);
+}
+
+void ParseScheduler::run_()
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (!stop_) {
+        if (pending_.empty()) {
+            cv_.wait(lock);
+            continue;
+        }
+
+        auto next = pending_.begin();
+        for (auto pos = pending_.begin(); pos != pending_.end(); ++pos) {
+            if (pos->second.due < next->second.due) {
+                next = pos;
+            }
+        }
+
+        auto due = next->second.due;
+        if (due > Clock::now()) {
+            // a new job or a newer version may arrive meanwhile, pick again after waking up
+            cv_.wait_until(lock, due);
+            continue;
+        }
+
+        std::string uri = next->first;
+        Job job = std::move(next->second);
+        pending_.erase(next);
+        lock.unlock();
+
+        Doc doc(uri, job.version, job.text, job.option);
+        bool success = doc.parse();
+        on_parsed_(std::move(doc), success);
+
+        lock.lock();
+    }
+}
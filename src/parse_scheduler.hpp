@@ -0,0 +1,47 @@
+#ifndef __GLSLX_PARSE_SCHEDULER_HPP__
+#define __GLSLX_PARSE_SCHEDULER_HPP__
+#include "args.hpp"
+#include "doc.hpp"
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+
+// parses documents on a worker thread. only the newest version of each document is kept,
+// and a version is parsed once no newer one arrived within the debounce interval.
+class ParseScheduler {
+public:
+    using Clock = std::chrono::steady_clock;
+    using Callback = std::function<void(Doc&& doc, bool success)>;
+
+    ParseScheduler(Callback on_parsed, Clock::duration debounce);
+    ParseScheduler(const ParseScheduler&) = delete;
+    ParseScheduler& operator=(const ParseScheduler&) = delete;
+    ~ParseScheduler();
+
+    void schedule(std::string const& uri, const int version, std::string const& text, CompileOption const& option,
+                  bool immediate = false);
+    void cancel(std::string const& uri);
+
+private:
+    struct Job {
+        int version;
+        std::string text;
+        CompileOption option;
+        Clock::time_point due;
+    };
+
+    Callback on_parsed_;
+    Clock::duration debounce_;
+    std::map<std::string, Job> pending_;
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    bool stop_ = false;
+    std::thread worker_;
+
+    void run_();
+};
+#endif
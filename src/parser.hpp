@@ -13,10 +13,11 @@ struct ParserResouce {
     glslang::TScanContext* scan_context;
     glslang::TPpContext* ppcontext;
     DirStackFileIncluder* includer;
+    TInfoSink* info_sink;
 
     ParserResouce(glslang::TSymbolTable* symbol_table, glslang::TIntermediate* intermediate,
                   glslang::TParseContext* parse_context, glslang::TScanContext* scan_context,
-                  glslang::TPpContext* ppcontext, DirStackFileIncluder* includer)
+                  glslang::TPpContext* ppcontext, DirStackFileIncluder* includer, TInfoSink* info_sink)
     {
         this->symbol_table = symbol_table;
         this->intermediate = intermediate;
@@ -24,9 +25,30 @@ struct ParserResouce {
         this->scan_context = scan_context;
         this->ppcontext = ppcontext;
         this->includer = includer;
+        this->info_sink = info_sink;
+    }
+
+    ParserResouce(const ParserResouce&) = delete;
+    ParserResouce& operator=(const ParserResouce&) = delete;
+
+    // symbol_table only owns its own scope, the built-in levels it adopted are shared.
+    ~ParserResouce()
+    {
+        delete ppcontext;
+        delete scan_context;
+        delete parse_context;
+        delete intermediate;
+        delete symbol_table;
+        delete includer;
+        delete info_sink;
     }
 };
 
 extern std::unique_ptr<ParserResouce> create_parser(const int version, EProfile profile, EShLanguage stage,
                                                     glslang::SpvVersion spvVersion, const char* entrypoint);
+// parse the common, the stage specific and the resource dependent built-in declarations of a language into table,
+// allocating from the current thread pool
+extern bool add_stage_builtin_symbols(glslang::TSymbolTable& table, const TBuiltInResource* resources,
+                                      const int version, EProfile profile, EShLanguage stage,
+                                      glslang::SpvVersion const& spvVersion);
 #endif
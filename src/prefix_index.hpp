@@ -0,0 +1,72 @@
+#ifndef __GLSLX_PREFIX_INDEX_HPP__
+#define __GLSLX_PREFIX_INDEX_HPP__
+#include <algorithm>
+#include <string_view>
+#include <vector>
+
+// names sorted once so that every name starting with a prefix is one contiguous range, found with
+// two binary searches. names are views of strings owned elsewhere (a DocIR or a symbol table), the
+// index must not outlive them.
+template <typename T> class PrefixIndex {
+public:
+    struct Entry {
+        std::string_view name;
+        T value;
+    };
+
+    class Range {
+    public:
+        Range() = default;
+        Range(const Entry* begin, const Entry* end) : begin_(begin), end_(end) {}
+
+        const Entry* begin() const { return begin_; }
+        const Entry* end() const { return end_; }
+        size_t size() const { return end_ - begin_; }
+        bool empty() const { return begin_ == end_; }
+
+    private:
+        const Entry* begin_ = nullptr;
+        const Entry* end_ = nullptr;
+    };
+
+    void clear() { entries_.clear(); }
+    void add(std::string_view name, T value) { entries_.push_back({name, value}); }
+    // entries with the same name keep the order they were added in
+    void build()
+    {
+        std::stable_sort(entries_.begin(), entries_.end(),
+                         [](Entry const& lhs, Entry const& rhs) { return lhs.name < rhs.name; });
+    }
+
+    Range lookup(std::string_view prefix) const
+    {
+        auto first = std::lower_bound(entries_.begin(), entries_.end(), prefix,
+                                      [](Entry const& e, std::string_view prefix) { return e.name < prefix; });
+        auto last = std::upper_bound(first, entries_.end(), prefix, [](std::string_view prefix, Entry const& e) {
+            return prefix < e.name.substr(0, prefix.size());
+        });
+        return make_range_(first, last);
+    }
+
+    Range find(std::string_view name) const
+    {
+        auto [first, last] = std::equal_range(entries_.begin(), entries_.end(), Entry{name, T{}},
+                                              [](Entry const& lhs, Entry const& rhs) { return lhs.name < rhs.name; });
+        return make_range_(first, last);
+    }
+
+    Range all() const { return make_range_(entries_.begin(), entries_.end()); }
+
+private:
+    std::vector<Entry> entries_;
+
+    Range make_range_(typename std::vector<Entry>::const_iterator first,
+                      typename std::vector<Entry>::const_iterator last) const
+    {
+        if (first == last) {
+            return {};
+        }
+        return {&*first, &*first + (last - first)};
+    }
+};
+#endif
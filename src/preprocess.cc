@@ -0,0 +1,57 @@
+#include "preprocess.hpp"
+#include "include_cache.hpp"
+
+PreprocessCache& PreprocessCache::get()
+{
+    static PreprocessCache cache;
+    return cache;
+}
+
+static bool includes_unchanged(PreprocessResult const& result)
+{
+    auto& include_cache = IncludeCache::get();
+    for (auto const& [path, hash] : result.includes) {
+        if (include_cache.hash(path) != hash) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+std::shared_ptr<const PreprocessResult> PreprocessCache::find(uint64_t key)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto pos = index_.find(key);
+    if (pos == index_.end()) {
+        return nullptr;
+    }
+
+    if (!includes_unchanged(*pos->second->second)) {
+        entries_.erase(pos->second);
+        index_.erase(pos);
+        return nullptr;
+    }
+
+    entries_.splice(entries_.begin(), entries_, pos->second);
+    return pos->second->second;
+}
+
+void PreprocessCache::insert(uint64_t key, std::shared_ptr<const PreprocessResult> result)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto pos = index_.find(key);
+    if (pos != index_.end()) {
+        pos->second->second = std::move(result);
+        entries_.splice(entries_.begin(), entries_, pos->second);
+        return;
+    }
+
+    entries_.emplace_front(key, std::move(result));
+    index_[key] = entries_.begin();
+
+    if (entries_.size() > kCapacity) {
+        index_.erase(entries_.back().first);
+        entries_.pop_back();
+    }
+}
@@ -0,0 +1,62 @@
+#ifndef __GLSLX_PREPROCESS_HPP__
+#define __GLSLX_PREPROCESS_HPP__
+#include <cstdint>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// everything one preprocessor pass over a document produces.
+struct PreprocessResult {
+    bool success = false;
+    // #if/#elif results per file, keyed by file name then line
+    std::map<std::string, std::map<int, int>> pp_cond_res;
+    // headers reached through #include and the IncludeCache hash of their content when they were read
+    std::vector<std::pair<std::string, uint64_t>> includes;
+};
+
+// process wide cache of preprocessor results keyed by text hash plus everything else the preprocessor sees
+// (uri, macros, include dirs, version). the main thread and the parse worker share it, so a document
+// version is preprocessed only once.
+class PreprocessCache {
+public:
+    static PreprocessCache& get();
+
+    // an entry is dropped if one of its headers changed, on disk or in the editor
+    std::shared_ptr<const PreprocessResult> find(uint64_t key);
+    void insert(uint64_t key, std::shared_ptr<const PreprocessResult> result);
+
+private:
+    using Entry = std::pair<uint64_t, std::shared_ptr<const PreprocessResult>>;
+    static constexpr size_t kCapacity = 64;
+
+    std::mutex mutex_;
+    // most recently used first
+    std::list<Entry> entries_;
+    std::unordered_map<uint64_t, std::list<Entry>::iterator> index_;
+};
+
+inline uint64_t hash_combine(uint64_t seed, uint64_t value)
+{
+    return seed ^ (value + 0x9e3779b97f4a7c15ULL + (seed << 6) + (seed >> 2));
+}
+
+// FNV-1a, stable across runs and builds unlike std::hash. used for everything that is persisted.
+inline uint64_t stable_hash(const char* data, size_t size, uint64_t seed = 0xcbf29ce484222325ULL)
+{
+    uint64_t hash = seed;
+    for (size_t i = 0; i < size; ++i) {
+        hash ^= static_cast<unsigned char>(data[i]);
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+inline uint64_t stable_hash(std::string const& s, uint64_t seed = 0xcbf29ce484222325ULL)
+{
+    return stable_hash(s.data(), s.size(), seed);
+}
+#endif
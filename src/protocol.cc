@@ -1,24 +1,41 @@
 #include "protocol.hpp"
 #include "completion.hpp"
+#include "diagnostics.hpp"
 #include "document_symbol.hpp"
+#include "hover.hpp"
+#include "include_cache.hpp"
 #include "semantic_token.hpp"
+#include "stats.hpp"
 #include <algorithm>
 #include <cctype>
 #include <cstdio>
 #include <iostream>
 #include <iterator>
+#include <map>
 #include <ostream>
-#include <regex>
 #include <set>
-#include <sstream>
 #include <vector>
 
+Protocol::Protocol()
+    : writer_(1), scheduler_([this](Doc&& doc, bool success) { on_parsed_(std::move(doc), success); },
+                 std::chrono::milliseconds(300))
+{
+}
+
 int Protocol::handle(nlohmann::json& req)
 {
+    // the client waits for the parse worker too
+    auto start = std::chrono::steady_clock::now();
+    std::lock_guard<std::mutex> lock(mutex_);
     nlohmann::json resp;
     // fprintf(stderr, "start handle protocol req: \n%s\n", req.dump(4).c_str());
     // fflush(stderr);
 
+    // replies to the requests the server sent
+    if (!req.contains("method")) {
+        return 0;
+    }
+
     std::string method = req["method"];
     if (method != "initialize" && !init_) {
         fprintf(stderr, "received request buf server is uninitialized. \n");
@@ -31,25 +48,72 @@ int Protocol::handle(nlohmann::json& req)
         return 0;
     } else if (method == "workspace/didChangeConfiguration") {
         return 0;
+    } else if (method == "$/cancelRequest") {
+        // requests are cancelled while still queued, see cancel()
+        return 0;
     } else if (method == "textDocument/didOpen") {
         did_open_(req);
     } else if (method == "textDocument/definition") {
         definition_(req);
+    } else if (method == "textDocument/references") {
+        references_(req);
     } else if (method == "textDocument/didChange") {
         did_change_(req);
     } else if (method == "textDocument/completion") {
         completion_(req);
+    } else if (method == "completionItem/resolve") {
+        completion_resolve_(req);
     } else if (method == "textDocument/didSave") {
         did_save_(req);
+    } else if (method == "textDocument/didClose") {
+        did_close_(req);
     } else if (method == "textDocument/documentSymbol") {
         document_symbol_(req);
+    } else if (method == "textDocument/hover") {
+        hover_(req);
+    } else if (method == "textDocument/diagnostic") {
+        diagnostic_(req);
+    } else if (method == "workspace/diagnostic") {
+        workspace_diagnostic_(req);
+    } else if (method == "workspace/symbol") {
+        workspace_symbol_(req);
     } else if (method == "textDocument/semanticTokens/full") {
         semantic_token_(req);
+    } else if (method == "textDocument/semanticTokens/full/delta") {
+        semantic_token_delta_(req);
+    } else if (method == "textDocument/semanticTokens/range") {
+        semantic_token_range_(req);
+    } else if (method == "$/glslx/stats") {
+        stats_(req);
+    } else {
+        return 0;
     }
 
+    auto elapsed = std::chrono::steady_clock::now() - start;
+    auto& stats = method_stats_[method];
+    if (!stats) {
+        stats = &Stats::get().method(method);
+    }
+    stats->record(std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count());
     return 0;
 }
 
+void Protocol::cancel(nlohmann::json& req)
+{
+    if (!req.contains("id")) {
+        return;
+    }
+
+    // RequestCancelled
+    nlohmann::json body = {
+        {"jsonrpc", "2.0"},
+        {"id", req["id"]},
+        {"error", {{"code", -32800}, {"message", "request cancelled"}}},
+    };
+
+    send_to_client_(body);
+}
+
 void Protocol::make_response_(nlohmann::json& req, nlohmann::json* result)
 {
     nlohmann::json body;
@@ -89,18 +153,18 @@ void Protocol::initialize_(nlohmann::json& req)
 		"capabilities": {
 			"textDocumentSync": {
 				"openClose": true,
-				"change": 1,
+				"change": 2,
 				"save": true,
 				"willSave": false 
 			},
 			"completionProvider": {
 				"triggerCharacters": ["."],
-				"resolveProvider": false,
+				"resolveProvider": true,
 				"completionItem": {
 					"labelDetailsSupport": true
 				}
 			},
-			"hoverProvider": false,
+			"hoverProvider": true,
 			"signatureHelpProvider": {
 				"triggerCharacters": []
 			},
@@ -129,13 +193,20 @@ void Protocol::initialize_(nlohmann::json& req)
 					"tokenTypes": ["type", "struct", "parameter", "variable", "function", "keyword", "macro", "modifier", "number", "operator", "comment"],
 					"tokenModifiers": ["declaration", "definition", "readonly", "static"]
 				},
-				"full": true
+				"full": {
+					"delta": true
+				},
+				"range": true
+			},
+			"diagnosticProvider": {
+				"interFileDependencies": true,
+				"workspaceDiagnostics": true
 			},
 			"monikerProvider": false,
 			"typeHierarchyProvider": false,
 			"inlineValueProvider": false,
 			"inlayHintProvider": false,
-			"workspaceSymbolProvider": false
+			"workspaceSymbolProvider": true
 		}
 	}
 	)");
@@ -143,6 +214,34 @@ void Protocol::initialize_(nlohmann::json& req)
     nlohmann::json params = req["params"];
     workspace_.init(params["rootPath"]);
 
+    // snippets can wait for completionItem/resolve too if the client asks for insertText there
+    nlohmann::json::json_pointer resolve_support("/capabilities/textDocument/completion/completionItem/resolveSupport");
+    auto properties = params.value(resolve_support / "properties", nlohmann::json::array());
+    resolve_insert_text_ = std::find(properties.begin(), properties.end(), "insertText") != properties.end();
+
+    // pulled diagnostics replace the pushed ones if the client can be told to pull again after a parse
+    nlohmann::json::json_pointer pull("/capabilities/textDocument/diagnostic");
+    nlohmann::json::json_pointer refresh("/capabilities/workspace/diagnostics/refreshSupport");
+    pull_diagnostics_ = params.contains(pull) && params.value(refresh, false);
+
+    // tokens classified while a document had no IR are asked for again once its parse is back
+    nlohmann::json::json_pointer tokens_refresh("/capabilities/workspace/semanticTokens/refreshSupport");
+    refresh_semantic_tokens_ = params.value(tokens_refresh, false);
+
+    // MiB the IRs of the open documents may take, the least recently used are released beyond it
+    nlohmann::json::json_pointer memory_budget("/initializationOptions/memoryBudget");
+    if (params.contains(memory_budget) && params[memory_budget].is_number_unsigned()) {
+        workspace_.set_memory_budget(params[memory_budget].get<size_t>() << 20);
+    }
+
+    // lines are kept in utf-8, take utf-8 positions if the client offers them and convert utf-16 ones otherwise
+    nlohmann::json::json_pointer encodings("/capabilities/general/positionEncodings");
+    auto offered = params.value(encodings, nlohmann::json::array());
+    bool utf8 = std::find(offered.begin(), offered.end(), "utf-8") != offered.end();
+    workspace_.set_position_encoding(utf8 ? PositionEncoding::UTF8 : PositionEncoding::UTF16);
+    semantic_tokens_.set_position_encoding(utf8 ? PositionEncoding::UTF8 : PositionEncoding::UTF16);
+    result["capabilities"]["positionEncoding"] = utf8 ? "utf-8" : "utf-16";
+
     init_ = true;
     make_response_(req, &result);
 }
@@ -159,111 +258,142 @@ void Protocol::did_open_(nlohmann::json& req)
     std::string uri = textDoc["uri"];
     int version = textDoc["version"];
     std::string source = textDoc["text"];
-    Doc doc(uri, version, source, workspace_.get_compile_option(uri));
     const auto& compile_option = workspace_.get_compile_option(uri);
-    if (!doc.parse()) {
-        publish_diagnostics(doc.info_log());
-    } else {
-        publish_clear_diagnostics(uri);
-    }
+    Doc doc(uri, version, source, compile_option);
     workspace_.add_doc(std::move(doc));
+    scheduler_.schedule(uri, version, source, compile_option, true);
 }
 
 void Protocol::did_save_(nlohmann::json& req)
 {
     auto& params = req["params"];
     std::string uri = params["textDocument"]["uri"];
-    int version = params["textDocument"]["version"];
 
-    auto [ret, doc] = workspace_.save_doc(uri, version);
-    if (doc) {
-        if (ret)
-            publish_clear_diagnostics(uri);
-        else
-            publish_diagnostics(doc->info_log());
+    workspace_.save_doc(uri);
+    if (auto* doc = workspace_.get_doc(uri)) {
+        scheduler_.schedule(uri, doc->version(), doc->text(), doc->option(), true);
     }
+    schedule_dependents_(uri, true);
 }
 
-void Protocol::completion_(nlohmann::json& req)
+void Protocol::did_close_(nlohmann::json& req)
 {
-    auto& params = req["params"];
-    // int triggerKind = params["context"]["triggerKind"];
-    int line = params["position"]["line"];
-    int col = params["position"]["character"];
-    std::string uri = params["textDocument"]["uri"];
-
-    auto doc = workspace_.get_doc(uri);
-    nlohmann::json completion_items;
-    if (!doc) {
-        make_response_(req, &completion_items);
-        return;
+    std::string uri = req["params"]["textDocument"]["uri"];
+
+    scheduler_.cancel(uri);
+    semantic_tokens_.remove(uri);
+    forget_completion_items(uri);
+    completion_ranker_.forget(uri);
+    workspace_.close_doc(uri);
+    // documents including it see the header on disk again
+    schedule_dependents_(uri, true);
+
+    if (!pull_diagnostics_) {
+        auto headers = std::move(published_[uri]);
+        published_.erase(uri);
+        headers.insert(uri);
+        size_t left = headers.size();
+        for (auto const& file : headers) {
+            nlohmann::json body = {{"uri", file}, {"diagnostics", nlohmann::json::array()}};
+            publish_("textDocument/publishDiagnostics", &body, --left == 0);
+        }
     }
+}
 
-    auto get_words = [this, &uri, line, col](int tok) { return workspace_.get_sentence(uri, line, col, tok); };
-    std::vector<std::string> sentence = {get_words(';'), get_words('\n'), get_words('('), get_words('['),
-                                         get_words('{'), get_words(' '),  get_words('#')};
-
-    std::set<std::string> uniq_sentence(sentence.cbegin(), sentence.cend());
+void Protocol::schedule_dependents_(std::string const& uri, bool immediate)
+{
+    for (auto const& dependent : workspace_.get_dependents(uri)) {
+        auto* doc = workspace_.get_doc(dependent);
+        scheduler_.schedule(dependent, doc->version(), doc->text(), doc->option(), immediate);
+    }
+}
 
-    std::vector<std::string> anon_prefix;
-    for (auto sym : doc->lookup_symbols_by_prefix(nullptr, "anon@")) {
-        if (!sym->isStruct())
-            continue;
-        anon_prefix.push_back(sym->getName().c_str());
+void Protocol::on_parsed_(Doc&& doc, bool success)
+{
+    std::string uri = doc.uri();
+    FileIndex file_index;
+    if (success) {
+        file_index = make_file_index(doc);
     }
 
-    CompletionResultSet complete_results;
-    for (auto& word : uniq_sentence) {
-        completion(*doc, {}, word, line, col, complete_results);
-        if (!isalpha(word.front()) && word.front() != '_') {
-            continue;
-        }
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto* open = workspace_.get_doc(uri);
+    bool rehydrated = success && open && open->evicted();
+    if (!workspace_.install_doc(std::move(doc), success)) {
+        return;
+    }
 
-        for (auto const& prefix : anon_prefix) {
-            completion(*doc, prefix, word, line, col, complete_results);
-        }
+    // under the lock, a didClose meanwhile hands the uri back to the disk
+    if (success) {
+        workspace_.index().update(std::move(file_index));
     }
 
-    auto unique_candidates = [](auto& results) {
-        std::set<std::string> item_set;
-        std::vector<CompletionResult> final_results;
-        for (auto& item : results) {
-            if (item_set.count(item.insert_text) <= 0) {
-                item_set.insert(item.insert_text);
-                final_results.push_back(item);
-            }
-        }
+    publish_diagnostics(*workspace_.get_doc(uri));
+    if (rehydrated && refresh_semantic_tokens_) {
+        nlohmann::json body = {
+            {"jsonrpc", "2.0"},
+            {"id", "glslx/refresh/" + std::to_string(++refresh_id_)},
+            {"method", "workspace/semanticTokens/refresh"},
+        };
+        send_to_client_(body);
+    }
+}
 
-        results.swap(final_results);
-    };
+Doc* Protocol::use_doc_(std::string const& uri)
+{
+    bool rehydrate = false;
+    auto* doc = workspace_.use_doc(uri, &rehydrate);
+    // the worker brings the IR back, the request is answered without it
+    if (rehydrate) {
+        scheduler_.schedule(uri, doc->version(), doc->text(), doc->option(), true);
+    }
+    return doc;
+}
 
-    unique_candidates(complete_results.variables);
-    unique_candidates(complete_results.funcs);
-    unique_candidates(complete_results.types);
-    unique_candidates(complete_results.keywords);
-    unique_candidates(complete_results.builtins);
+void Protocol::completion_(nlohmann::json& req)
+{
+    auto& params = req["params"];
+    // int triggerKind = params["context"]["triggerKind"];
+    int line = params["position"]["line"];
+    int character = params["position"]["character"];
+    std::string uri = params["textDocument"]["uri"];
 
-    std::vector<CompletionResult> results;
+    auto doc = use_doc_(uri);
+    nlohmann::json completion_items = nlohmann::json::array();
+    if (!doc) {
+        make_response_(req, &completion_items);
+        return;
+    }
 
-    auto append_to_results = [&results](auto const& candidates) {
-        std::copy(candidates.cbegin(), candidates.cend(), std::back_inserter(results));
-    };
+    // the identifier being typed, candidates are matched against it fuzzily
+    static const std::string empty;
+    auto const& lines = doc->lines();
+    std::string const& text = line >= 0 && line < lines.size() ? lines[line] : empty;
+    auto context = analyze_completion_context(text, utf8_column(text, character, workspace_.position_encoding()));
+    std::string word = context.prefix;
 
-    append_to_results(complete_results.variables);
-    append_to_results(complete_results.funcs);
-    append_to_results(complete_results.types);
-    append_to_results(complete_results.keywords);
-    append_to_results(complete_results.builtins);
+    CompletionRanker::Result ranked;
+    if (completion_ranker_.can_narrow(uri, line, context.start, word)) {
+        ranked = completion_ranker_.narrow(word);
+    } else {
+        // candidates are collected for the first character only, the ranker matches the rest
+        if (context.prefix.size() > 1) {
+            context.prefix.resize(1);
+        }
 
-    if (results.size() >= 200) {
-        results.resize(200);
+        CompletionResultSet complete_results;
+        completion(*doc, context, line + 1, complete_results);
+        ranked = completion_ranker_.rank(*doc, line, context.start, word, complete_results);
     }
 
-    for (auto const& result : results) {
-        completion_items.push_back(result.json());
-    }
+    nlohmann::json completion_list = ranked.json(resolve_insert_text_);
+    make_response_(req, &completion_list);
+}
 
-    make_response_(req, &completion_items);
+void Protocol::completion_resolve_(nlohmann::json& req)
+{
+    auto resolved = completion_ranker_.resolve(req["params"]);
+    make_response_(req, &resolved);
 }
 
 void Protocol::definition_(nlohmann::json& req)
@@ -276,69 +406,248 @@ void Protocol::definition_(nlohmann::json& req)
 
     auto& params = req["params"];
     std::string uri = params["textDocument"]["uri"];
-    int col = params["position"]["character"];
     int line = params["position"]["line"];
+    int col = workspace_.byte_column(uri, line, params["position"]["character"]);
 
     // fprintf(stderr, "target sym at %d:%d\n", line, col);
-    auto loc = workspace_.locate_symbol_def(uri, line + 1, col + 1);
-
-    if (loc.name) {
-        nlohmann::json result;
-        nlohmann::json start = {{"line", loc.line - 1}, {"character", loc.column - 1}};
-        result["uri"] = loc.name->c_str();
-        result["range"] = {{"start", start}, {"end", start}};
+    use_doc_(uri);
+    Location location;
+    if (workspace_.locate_symbol_def(uri, line + 1, col + 1, location)) {
+        location.range = workspace_.client_range(location.uri, location.range);
+        nlohmann::json result = location.json();
         make_response_(req, &result);
-    } else {
+        return;
+    }
+
+    // not declared in this document, e.g. a function of another file
+    nlohmann::json result = nlohmann::json::array();
+    for (auto const& def : workspace_.locate_indexed_defs(uri, line + 1, col + 1)) {
+        auto def_uri = path_to_uri(def.file);
+        Position start = {def.line - 1, def.column - 1};
+        result.push_back(Location{def_uri, workspace_.client_range(def_uri, {start, start})}.json());
+    }
+
+    if (result.empty()) {
         make_response_(req, nullptr);
+    } else {
+        make_response_(req, &result);
     }
 }
 
+void Protocol::references_(nlohmann::json& req)
+{
+    auto& params = req["params"];
+    std::string uri = params["textDocument"]["uri"];
+    int line = params["position"]["line"];
+    int col = workspace_.byte_column(uri, line, params["position"]["character"]);
+    bool include_declaration = true;
+    if (params.contains("context")) {
+        include_declaration = params["context"].value("includeDeclaration", true);
+    }
+
+    use_doc_(uri);
+    nlohmann::json result = nlohmann::json::array();
+    for (auto location : workspace_.references(uri, line + 1, col + 1, include_declaration)) {
+        location.range = workspace_.client_range(location.uri, location.range);
+        result.push_back(location.json());
+    }
+
+    make_response_(req, &result);
+}
+
 void Protocol::did_change_(nlohmann::json& req)
 {
     auto& params = req["params"];
     auto& textDoc = params["textDocument"];
     std::string uri = textDoc["uri"];
     int version = textDoc["version"];
-    std::string source = params["contentChanges"][0]["text"];
-    workspace_.update_doc(uri, version, source);
+
+    std::vector<TextDocumentContentChangeEvent> changes;
+    for (auto& change : params["contentChanges"]) {
+        TextDocumentContentChangeEvent event = {false, {}, change["text"].get<std::string>()};
+        if (change.contains("range")) {
+            auto& range = change["range"];
+            event.has_range = true;
+            event.range.start = {range["start"]["line"], range["start"]["character"]};
+            event.range.end = {range["end"]["line"], range["end"]["character"]};
+        }
+        changes.emplace_back(std::move(event));
+    }
+
+    workspace_.update_doc(uri, version, changes);
+
+    if (auto* doc = workspace_.get_doc(uri)) {
+        scheduler_.schedule(uri, doc->version(), doc->text(), doc->option());
+    }
+    schedule_dependents_(uri, false);
+}
+
+// the byte columns of a document symbol and its children in the negotiated encoding
+static void client_ranges(Workspace& workspace, std::string const& uri, DocumentSymbol& symbol)
+{
+    symbol.range = workspace.client_range(uri, symbol.range);
+    symbol.selectionRange = workspace.client_range(uri, symbol.selectionRange);
+    for (auto& child : symbol.children) {
+        client_ranges(workspace, uri, child);
+    }
 }
 
 void Protocol::document_symbol_(nlohmann::json& req)
 {
     auto& params = req["params"];
     std::string uri = params["textDocument"]["uri"];
-    auto* doc = workspace_.get_doc(uri);
+    auto* doc = use_doc_(uri);
     auto arr = nlohmann::json::array({});
     if (!doc) {
         make_response_(req, &arr);
+        return;
     }
 
     auto symbols = document_symbol(doc);
 
-    for (auto const& s : symbols) {
+    for (auto& s : symbols) {
+        client_ranges(workspace_, uri, s);
         arr.push_back(s.json());
     }
 
     make_response_(req, &arr);
 }
 
+void Protocol::hover_(nlohmann::json& req)
+{
+    auto& params = req["params"];
+    std::string uri = params["textDocument"]["uri"];
+    int line = params["position"]["line"];
+    int col = workspace_.byte_column(uri, line, params["position"]["character"]);
+
+    Hover result;
+    auto* doc = use_doc_(uri);
+    if (!doc || !hover(*doc, line + 1, col + 1, result)) {
+        make_response_(req, nullptr);
+        return;
+    }
+
+    if (result.has_range) {
+        result.range = workspace_.client_range(uri, result.range);
+    }
+
+    auto json = result.json();
+    make_response_(req, &json);
+}
+
 void Protocol::semantic_token_(nlohmann::json& req)
 {
     auto& params = req["params"];
     std::string uri = params["textDocument"]["uri"];
-    auto* doc = workspace_.get_doc(uri);
+    auto* doc = use_doc_(uri);
+    if (!doc) {
+        make_response_(req, nullptr);
+        return;
+    }
+
+    auto result = semantic_tokens_.full(*doc);
+    make_response_(req, &result);
+}
+
+void Protocol::semantic_token_delta_(nlohmann::json& req)
+{
+    auto& params = req["params"];
+    std::string uri = params["textDocument"]["uri"];
+    auto* doc = use_doc_(uri);
+    if (!doc) {
+        make_response_(req, nullptr);
+        return;
+    }
+
+    std::string previous_result_id = params.value("previousResultId", "");
+    auto result = semantic_tokens_.delta(*doc, previous_result_id);
+    make_response_(req, &result);
+}
+
+void Protocol::semantic_token_range_(nlohmann::json& req)
+{
+    auto& params = req["params"];
+    std::string uri = params["textDocument"]["uri"];
+    auto* doc = use_doc_(uri);
     if (!doc) {
         make_response_(req, nullptr);
+        return;
+    }
+
+    int start_line = params["range"]["start"]["line"];
+    int end_line = params["range"]["end"]["line"];
+    auto result = semantic_tokens_.range(*doc, start_line, end_line);
+    make_response_(req, &result);
+}
+
+void Protocol::diagnostic_(nlohmann::json& req)
+{
+    auto& params = req["params"];
+    std::string uri = params["textDocument"]["uri"];
+    std::string previous_result_id = params.value("previousResultId", "");
+    auto* doc = workspace_.get_doc(uri);
+    if (!doc) {
+        nlohmann::json report = {{"kind", "full"}, {"items", nlohmann::json::array()}};
+        make_response_(req, &report);
+        return;
     }
 
-    auto tokens = semantic_token(doc);
-    nlohmann::json result;
-    result["data"] = tokens;
+    auto report = document_diagnostic_report(*doc, previous_result_id);
+    make_response_(req, &report);
+}
+
+void Protocol::workspace_diagnostic_(nlohmann::json& req)
+{
+    std::map<std::string, std::string> previous_result_ids;
+    for (auto const& previous : req["params"].value("previousResultIds", nlohmann::json::array())) {
+        previous_result_ids[previous["uri"]] = previous["value"];
+    }
+
+    nlohmann::json items = nlohmann::json::array();
+    for (auto const& uri : workspace_.doc_uris()) {
+        auto pos = previous_result_ids.find(uri);
+        auto const& previous = pos == previous_result_ids.end() ? std::string() : pos->second;
+        items.push_back(workspace_diagnostic_report(*workspace_.get_doc(uri), previous));
+    }
 
+    nlohmann::json report = {{"items", std::move(items)}};
+    make_response_(req, &report);
+}
+
+void Protocol::workspace_symbol_(nlohmann::json& req)
+{
+    std::string query = req["params"].value("query", "");
+
+    nlohmann::json result = nlohmann::json::array();
+    for (auto const& symbol : workspace_.index().search(query, kMaxWorkspaceSymbols)) {
+        if (symbol.file.empty()) {
+            continue;
+        }
+
+        SymbolKind kind = SymbolKind::Variable;
+        if (symbol.kind == IndexSymbol::Kind::Function) {
+            kind = SymbolKind::Function;
+        } else if (symbol.kind == IndexSymbol::Kind::Struct) {
+            kind = SymbolKind::Struct;
+        }
+
+        Range range = {{symbol.line - 1, symbol.column - 1}, {symbol.end_line - 1, symbol.end_column - 1}};
+        // symbols of headers are filed under the path glslang reported
+        auto symbol_uri = path_to_uri(symbol.file);
+        range = workspace_.client_range(symbol_uri, range);
+        result.push_back(SymbolInformation{symbol.name, kind, {symbol_uri, range}}.json());
+    }
+
+    make_response_(req, &result);
+}
+
+void Protocol::stats_(nlohmann::json& req)
+{
+    auto result = Stats::get().json();
     make_response_(req, &result);
 }
 
-void Protocol::publish_(std::string const& method, nlohmann::json* params)
+void Protocol::publish_(std::string const& method, nlohmann::json* params, bool flush)
 {
     nlohmann::json body;
     if (!params) {
@@ -352,56 +661,50 @@ void Protocol::publish_(std::string const& method, nlohmann::json* params)
         body = {{"method", method}, {"params", *params}};
     }
 
-    send_to_client_(body);
+    send_to_client_(body, flush);
 }
 
-void Protocol::publish_diagnostics(std::string const& error)
+void Protocol::publish_diagnostics(Doc const& doc)
 {
-    std::stringstream ss(error);
-    std::string line;
-    std::map<std::string, nlohmann::json> diagnostics;
-
-    while (std::getline(ss, line)) {
-        std::smatch result;
-        std::regex pattern("ERROR: (file:///.*):([0-9]+): (.*)");
-        if (std::regex_match(line, result, pattern)) {
-            std::string uri = result[1].str();
-            int row = std::atoi(result[2].str().c_str()) - 1;
-            std::string message = result[3].str();
-            nlohmann::json start = {{"line", row}, {"character", 1}};
-            nlohmann::json diagnostic = {{"range", {{"start", start}, {"end", start}}}, {"message", message}};
-            diagnostics[uri].push_back(diagnostic);
+    if (pull_diagnostics_) {
+        // the client pulls them again
+        nlohmann::json body = {
+            {"jsonrpc", "2.0"},
+            {"id", "glslx/refresh/" + std::to_string(++refresh_id_)},
+            {"method", "workspace/diagnostic/refresh"},
+        };
+        send_to_client_(body);
+        return;
+    }
+
+    // the document is always published, so that fixed errors go away
+    std::map<std::string, nlohmann::json> by_uri = {{doc.uri(), nlohmann::json::array()}};
+    for (auto const& diagnostic : doc.diagnostics()) {
+        auto& list = by_uri[diagnostic.uri];
+        if (list.is_null()) {
+            list = nlohmann::json::array();
         }
+        list.push_back(diagnostic.json());
     }
 
-    for (auto& [uri, diagnostic] : diagnostics) {
-        nlohmann::json body = {{"uri", uri}, {"diagnostics", diagnostic}};
-        publish_("textDocument/publishDiagnostics", &body);
+    // headers that had errors in the last parse and have none now
+    auto& published = published_[doc.uri()];
+    for (auto const& file : published) {
+        by_uri.emplace(file, nlohmann::json::array());
+    }
+    published.clear();
+    for (auto const& [file, list] : by_uri) {
+        if (file != doc.uri() && !list.empty()) {
+            published.insert(file);
+        }
     }
-}
 
-void Protocol::publish_clear_diagnostics(const std::string& uri)
-{
-    nlohmann::json body = nlohmann::json::parse(R"(
-	{
-		"diagnostics": []
-	}
-	)");
-    body["uri"] = uri;
-    publish_("textDocument/publishDiagnostics", &body);
+    // every file of one parse goes out in a single write
+    size_t left = by_uri.size();
+    for (auto& [file, list] : by_uri) {
+        nlohmann::json body = {{"uri", file}, {"diagnostics", std::move(list)}};
+        publish_("textDocument/publishDiagnostics", &body, --left == 0);
+    }
 }
 
-void Protocol::send_to_client_(nlohmann::json& content)
-{
-    std::string body_str = content.dump();
-
-    std::string header;
-    header.append("Content-Length: ");
-    header.append(std::to_string(body_str.size()) + "\r\n");
-    header.append("Content-Type: application/vscode-jsonrpc;charset=utf-8\r\n");
-    header.append("\r\n");
-    header.append(body_str);
-    // fprintf(stderr, "resp to client: \n%s\n", header.c_str());
-    std::cout << header;
-    std::flush(std::cout);
-}
+void Protocol::send_to_client_(nlohmann::json& content, bool flush) { writer_.send(content, flush); }
@@ -1,29 +1,74 @@
 #ifndef __GLSLX_PROTOCOL_HPP__
 #define __GLSLX_PROTOCOL_HPP__
+#include "completion.hpp"
+#include "message_writer.hpp"
 #include "nlohmann/json.hpp"
+#include "parse_scheduler.hpp"
+#include "semantic_token.hpp"
+#include "stats.hpp"
 #include "workspace.hpp"
+#include <map>
+#include <mutex>
+#include <set>
+#include <string>
 
 class Protocol {
     Workspace workspace_;
     bool init_ = false;
+    // workspace_ is shared with the parse worker
+    std::mutex mutex_;
+    MessageWriter writer_;
+    CompletionRanker completion_ranker_;
+    // the client resolves insertText in completionItem/resolve
+    bool resolve_insert_text_ = false;
+    SemanticTokenCache semantic_tokens_;
+    // the client pulls diagnostics and is sent workspace/diagnostic/refresh after a parse
+    bool pull_diagnostics_ = false;
+    int64_t refresh_id_ = 0;
+    // the client is sent workspace/semanticTokens/refresh after an evicted document is parsed again
+    bool refresh_semantic_tokens_ = false;
+    // headers each document last pushed diagnostics to, they are cleared once the errors are gone
+    std::map<std::string, std::set<std::string>> published_;
+    // latency of each method handled so far, looked up once so that a request does not take the stats lock
+    std::map<std::string, LatencyHistogram*> method_stats_;
+    // symbols answered per workspace/symbol request
+    static constexpr size_t kMaxWorkspaceSymbols = 256;
+    // declared last so that the worker is stopped before anything it uses goes away
+    ParseScheduler scheduler_;
 
     void make_response_(nlohmann::json& req, nlohmann::json* result);
     void initialize_(nlohmann::json& body);
     void did_open_(nlohmann::json& req);
     void definition_(nlohmann::json& req);
+    void references_(nlohmann::json& req);
     void did_change_(nlohmann::json& req);
     void did_save_(nlohmann::json& req);
+    void did_close_(nlohmann::json& req);
     void completion_(nlohmann::json& req);
+    void completion_resolve_(nlohmann::json& req);
     void document_symbol_(nlohmann::json& req);
+    void hover_(nlohmann::json& req);
     void semantic_token_(nlohmann::json& req);
+    void semantic_token_delta_(nlohmann::json& req);
+    void semantic_token_range_(nlohmann::json& req);
+    void diagnostic_(nlohmann::json& req);
+    void workspace_diagnostic_(nlohmann::json& req);
+    void workspace_symbol_(nlohmann::json& req);
+    void stats_(nlohmann::json& req);
 
-    void send_to_client_(nlohmann::json& content);
-    void publish_(std::string const& method, nlohmann::json* content);
-    void publish_diagnostics(const std::string& error);
-    void publish_clear_diagnostics(const std::string& uri);
+    void send_to_client_(nlohmann::json& content, bool flush = true);
+    void publish_(std::string const& method, nlohmann::json* content, bool flush = true);
+    void publish_diagnostics(Doc const& doc);
+    void on_parsed_(Doc&& doc, bool success);
+    void schedule_dependents_(std::string const& uri, bool immediate);
+    // the document at uri, marked as used. its parse is scheduled if its IR was released
+    Doc* use_doc_(std::string const& uri);
 
 public:
+    Protocol();
     int handle(nlohmann::json& req);
+    // reply to a request the client cancelled before it was handled
+    void cancel(nlohmann::json& req);
 };
 #endif
 
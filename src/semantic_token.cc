@@ -1,102 +1,377 @@
 #include "semantic_token.hpp"
+#include "completion.hpp"
 #include "doc.hpp"
+#include "stats.hpp"
 #include <algorithm>
+#include <cctype>
 #include <cstdio>
+#include <cstring>
+#include <string_view>
+#include <unordered_set>
 #include <vector>
 
-nlohmann::json semantic_token(Doc* doc)
+/*
+ * "tokenTypes": ["type", "struct", "parameter", "variable", "function", "keyword", "macro", "modifier", "number", "operator", "comment"],
+ * "tokenModifiers": ["declaration", "definition", "readonly", "static"]
+ * */
+enum TokenType {
+    kType = 0,
+    kStruct = 1,
+    kParameter = 2,
+    kVariable = 3,
+    kFunction = 4,
+    kKeyword = 5,
+    kMacro = 6,
+    kModifier = 7,
+    kNumber = 8,
+    kOperator = 9,
+    kComment = 10,
+};
+
+enum TokenModifier {
+    kDeclaration = 1 << 0,
+    kDefinition = 1 << 1,
+    kReadonly = 1 << 2,
+    kStatic = 1 << 3,
+};
+
+static bool is_ident_start(char c) { return isalpha(static_cast<unsigned char>(c)) || c == '_'; }
+static bool is_ident_char(char c) { return isalnum(static_cast<unsigned char>(c)) || c == '_'; }
+
+// keywords that are not type names, the rest of the keyword list names types
+static const std::unordered_set<std::string_view>& statement_keywords()
 {
-    /*
-	 * "tokenTypes": ["type", "struct", "parameter", "variable", "function", "keyword", "macro", "modifier", "number", "operator", "comment"],
-	 * "tokenModifiers": ["declaration", "definition", "readonly", "static"]
-	 * */
-    struct Token {
-        int line;
-        int col;
-        int length;
-        int type;
-        int modifier;
-    };
-
-    std::vector<Token> tokens;
-    nlohmann::json result;
-
-    if (!doc || doc->inactive_blocks().empty()) {
-        return result;
-    }
-#if 0
-    for (auto* sym : doc->globals()) {
-        const auto& name = sym->getName();
-        auto loc = sym->getLoc();
-        if (name.substr(0, 5) == "anon@") {
-            continue;
+    static const std::unordered_set<std::string_view> keywords = {
+        "const",     "uniform",   "buffer",    "in",        "out",           "inout",     "smooth",
+        "flat",      "centroid",  "invariant", "precise",   "struct",        "break",     "continue",
+        "do",        "for",       "while",     "switch",    "case",          "default",   "if",
+        "else",      "discard",   "return",    "true",      "false",         "layout",    "shared",
+        "highp",     "mediump",   "lowp",      "precision", "attribute",     "varying",   "noperspective",
+        "coherent",  "volatile",  "restrict",  "readonly",  "writeonly",     "patch",     "sample",
+        "subroutine", "demote",   "nonuniformEXT", "terminateInvocation", "terminateRayEXT",
+        "ignoreIntersectionEXT", "devicecoherent", "queuefamilycoherent", "workgroupcoherent",
+        "subgroupcoherent", "nonprivate", "nontemporal", "defined"};
+    return keywords;
+}
+
+static const std::unordered_set<std::string_view>& type_keywords()
+{
+    static const std::unordered_set<std::string_view> types = [] {
+        std::unordered_set<std::string_view> types;
+        for (auto* keyword : __keywords) {
+            if (!statement_keywords().count(keyword)) {
+                types.insert(keyword);
+            }
         }
-        tokens.push_back({loc.line - 1, loc.column - 1, (int)name.size(), 3, 1});
-    }
+        return types;
+    }();
+    return types;
+}
 
-    for (const auto& func : doc->func_defs()) {
-        auto loc = func.def->getLoc();
-        auto const& name = func.def->getName();
-        tokens.push_back({loc.line - 1, loc.column - 1, (int)name.size(), 4, 1});
+void SemanticTokenCache::lex_(std::vector<std::string> const& lines, std::vector<Lexeme>& lexemes)
+{
+    lexemes.clear();
+    bool in_comment = false;
+    for (int line = 0; line < static_cast<int>(lines.size()); ++line) {
+        auto const& text = lines[line];
+        const int size = text.size();
+        int i = 0;
 
-        for (auto* sym : func.local_defs) {
-            const auto& name = sym->getName();
-            auto loc = sym->getLoc();
-            if (name.substr(0, 5) == "anon@") {
+        if (in_comment) {
+            auto end = text.find("*/");
+            int stop = end == std::string::npos ? size : static_cast<int>(end) + 2;
+            if (stop > 0) {
+                lexemes.push_back({line, 0, stop, Lexeme::Kind::COMMENT});
+            }
+            if (end == std::string::npos) {
                 continue;
             }
-            tokens.push_back({loc.line - 1, loc.column - 1, (int)name.size(), 3, 1});
+            in_comment = false;
+            i = stop;
         }
 
-        for (auto* sym : func.local_uses) {
-            const auto& name = sym->getName();
-            auto loc = sym->getLoc();
-            if (name.substr(0, 5) == "anon@") {
+        // directives start a line, a # elsewhere is the stringizing or pasting operator
+        auto first = text.find_first_not_of(" \t");
+        // the identifier after #define is a macro
+        bool expect_macro = false;
+        while (i < size) {
+            char c = text[i];
+            if (c == '/' && i + 1 < size && text[i + 1] == '/') {
+                lexemes.push_back({line, i, size - i, Lexeme::Kind::COMMENT});
+                break;
+            }
+
+            if (c == '/' && i + 1 < size && text[i + 1] == '*') {
+                auto end = text.find("*/", i + 2);
+                if (end == std::string::npos) {
+                    lexemes.push_back({line, i, size - i, Lexeme::Kind::COMMENT});
+                    in_comment = true;
+                    break;
+                }
+                lexemes.push_back({line, i, static_cast<int>(end) + 2 - i, Lexeme::Kind::COMMENT});
+                i = end + 2;
                 continue;
             }
-            tokens.push_back({loc.line - 1, loc.column - 1, (int)name.size(), 3, 0});
+
+            if (c == '#' && static_cast<size_t>(i) == first) {
+                int start = i++;
+                while (i < size && (text[i] == ' ' || text[i] == '\t')) {
+                    ++i;
+                }
+                int name = i;
+                while (i < size && is_ident_char(text[i])) {
+                    ++i;
+                }
+                lexemes.push_back({line, start, i - start, Lexeme::Kind::DIRECTIVE});
+
+                std::string_view directive(text.data() + name, i - name);
+                if (directive == "define") {
+                    expect_macro = true;
+                } else if (directive == "include" || directive == "extension" || directive == "version" ||
+                           directive == "error" || directive == "pragma" || directive == "line") {
+                    // file names, extension names and messages are left to the client
+                    break;
+                }
+                continue;
+            }
+
+            if (c == '"') {
+                auto end = text.find('"', i + 1);
+                i = end == std::string::npos ? size : static_cast<int>(end) + 1;
+                continue;
+            }
+
+            if (is_ident_start(c)) {
+                int start = i;
+                while (i < size && is_ident_char(text[i])) {
+                    ++i;
+                }
+                lexemes.push_back(
+                    {line, start, i - start, expect_macro ? Lexeme::Kind::MACRO : Lexeme::Kind::IDENTIFIER});
+                expect_macro = false;
+                continue;
+            }
+
+            if (isdigit(static_cast<unsigned char>(c)) ||
+                (c == '.' && i + 1 < size && isdigit(static_cast<unsigned char>(text[i + 1])))) {
+                int start = i;
+                bool hex = c == '0' && i + 1 < size && (text[i + 1] == 'x' || text[i + 1] == 'X');
+                while (i < size) {
+                    char n = text[i];
+                    if (is_ident_char(n) || n == '.') {
+                        ++i;
+                    } else if ((n == '+' || n == '-') && !hex && (text[i - 1] == 'e' || text[i - 1] == 'E')) {
+                        ++i;
+                    } else {
+                        break;
+                    }
+                }
+                lexemes.push_back({line, start, i - start, Lexeme::Kind::NUMBER});
+                continue;
+            }
+
+            ++i;
+        }
+    }
+}
+
+void SemanticTokenCache::classify_(Doc& doc, std::vector<Lexeme> const& lexemes, std::vector<Token>& tokens)
+{
+    tokens.clear();
+    auto const& lines = doc.lines();
+    auto const* ir = doc.ir();
+    auto const& uri = doc.uri();
+
+    // inactive lines are one comment each
+    std::vector<bool> inactive(lines.size(), false);
+    for (auto const& block : doc.inactive_blocks()) {
+        for (int i = std::max(block.start, 0); i <= block.end && i < static_cast<int>(lines.size()); ++i) {
+            inactive[i] = true;
+            tokens.push_back({i, 0, static_cast<int>(lines[i].size()), kComment, 0});
         }
     }
-#endif
-    auto const& lines = doc->lines();
-    for (auto const& block : doc->inactive_blocks()) {
-        for (int i = block.start; i <= block.end; ++i) {
-            tokens.push_back({i, 0, (int)lines[i].size(), 10, 0});
+
+    std::unordered_set<std::string_view> macros;
+    for (auto const& lexeme : lexemes) {
+        if (lexeme.kind == Lexeme::Kind::MACRO) {
+            macros.insert(std::string_view(lines[lexeme.line]).substr(lexeme.column, lexeme.length));
         }
     }
 
-    std::sort(tokens.begin(), tokens.end(), [](Token const& lhs, Token const& rhs) {
-        if (lhs.line < rhs.line) {
-            return true;
+    for (auto const& lexeme : lexemes) {
+        if (lexeme.line >= static_cast<int>(lines.size()) || inactive[lexeme.line]) {
+            continue;
         }
 
-        if (lhs.line > rhs.line) {
-            return false;
+        Token token = {lexeme.line, lexeme.column, lexeme.length, -1, 0};
+        std::string_view name = std::string_view(lines[lexeme.line]).substr(lexeme.column, lexeme.length);
+        switch (lexeme.kind) {
+        case Lexeme::Kind::COMMENT:
+            token.type = kComment;
+            break;
+        case Lexeme::Kind::NUMBER:
+            token.type = kNumber;
+            break;
+        case Lexeme::Kind::DIRECTIVE:
+            token.type = kKeyword;
+            break;
+        case Lexeme::Kind::MACRO:
+            token.type = kMacro;
+            token.modifiers = kDeclaration;
+            break;
+        case Lexeme::Kind::IDENTIFIER: {
+            // AST lines and columns are 1-based
+            auto const* use = ir ? ir->lookup_symbol(lexeme.line + 1, lexeme.column + 1) : nullptr;
+            if (use && ir->str(use->name) == name) {
+                switch (use->kind) {
+                case DocIR::Symbol::Kind::FUNCTION:
+                    token.type = kFunction;
+                    break;
+                case DocIR::Symbol::Kind::PARAMETER:
+                    token.type = kParameter;
+                    break;
+                default:
+                    token.type = kVariable;
+                    break;
+                }
+                if (use->readonly) {
+                    token.modifiers |= kReadonly;
+                }
+                auto const& decl = use->decl;
+                if (decl.line == lexeme.line + 1 && decl.column == lexeme.column + 1 && uri == ir->str(decl.file)) {
+                    token.modifiers |= kDeclaration;
+                }
+            } else if (macros.count(name)) {
+                token.type = kMacro;
+            } else if (statement_keywords().count(name)) {
+                token.type = kKeyword;
+            } else if (type_keywords().count(name)) {
+                token.type = kType;
+            } else {
+                auto func = ir ? ir->function_at(lexeme.line + 1) : DocIR::kNone;
+                if (ir && (ir->find_struct(name, DocIR::kNone) ||
+                           (func != DocIR::kNone && ir->find_struct(name, func)))) {
+                    token.type = kStruct;
+                } else {
+                    auto builtins = doc.lookup_builtins_by_prefix(name);
+                    for (auto const& [builtin, sym] : builtins) {
+                        if (builtin == name) {
+                            token.type = sym->getAsFunction() ? kFunction : kVariable;
+                            break;
+                        }
+                    }
+                }
+            }
+        } break;
         }
 
-        return lhs.col < rhs.col;
+        if (token.type >= 0) {
+            tokens.push_back(token);
+        }
+    }
+
+    std::stable_sort(tokens.begin(), tokens.end(), [](Token const& lhs, Token const& rhs) {
+        return lhs.line < rhs.line || (lhs.line == rhs.line && lhs.column < rhs.column);
     });
+}
 
-    if (tokens.empty()) {
-        return result;
+void SemanticTokenCache::encode_(std::vector<std::string> const& lines, std::vector<Token>::const_iterator first,
+                                 std::vector<Token>::const_iterator last, std::vector<uint32_t>& data) const
+{
+    data.clear();
+    data.reserve((last - first) * 5);
+    int line = 0;
+    int column = 0;
+    for (auto pos = first; pos != last; ++pos) {
+        // tokens are lexed in bytes, the client counts in its encoding
+        std::string_view text = pos->line < static_cast<int>(lines.size()) ? lines[pos->line] : std::string_view();
+        const int start = client_column(text, pos->column, encoding_);
+        const int length = client_column(text, pos->column + pos->length, encoding_) - start;
+
+        int delta_line = pos->line - line;
+        int delta_column = delta_line == 0 ? start - column : start;
+        data.push_back(delta_line);
+        data.push_back(delta_column);
+        data.push_back(length);
+        data.push_back(pos->type);
+        data.push_back(pos->modifiers);
+        line = pos->line;
+        column = start;
+    }
+}
+
+SemanticTokenCache::Entry& SemanticTokenCache::update_(Doc& doc)
+{
+    static auto& cache_stats = Stats::get().cache("semanticTokens");
+    auto& entry = entries_[doc.uri()];
+    if (entry.lexed_version != doc.version() || entry.lexemes.empty()) {
+        lex_(doc.lines(), entry.lexemes);
+        entry.lexed_version = doc.version();
     }
 
-    result.push_back(tokens[0].line);
-    result.push_back(tokens[0].col);
-    result.push_back(tokens[0].length);
-    result.push_back(tokens[0].type);
-    result.push_back(tokens[0].modifier);
-
-    for (int i = 1; i < tokens.size(); ++i) {
-        int line = tokens[i].line - tokens[i - 1].line;
-        int col = line == 0 ? tokens[i].col - tokens[i - 1].col : tokens[i].col;
-
-        result.push_back(line);
-        result.push_back(col);
-        result.push_back(tokens[i].length);
-        result.push_back(tokens[i].type);
-        result.push_back(tokens[i].modifier);
+    bool hit = !entry.result_id.empty() && entry.version == doc.version() && entry.parse_id == doc.parse_id();
+    cache_stats.access(hit);
+    if (!hit) {
+        classify_(doc, entry.lexemes, entry.tokens);
+        encode_(doc.lines(), entry.tokens.begin(), entry.tokens.end(), entry.data);
+        entry.version = doc.version();
+        entry.parse_id = doc.parse_id();
+        entry.result_id = std::to_string(++next_result_id_);
     }
 
-    return result;
+    return entry;
+}
+
+nlohmann::json SemanticTokenCache::full(Doc& doc)
+{
+    auto& entry = update_(doc);
+    return {{"resultId", entry.result_id}, {"data", entry.data}};
+}
+
+nlohmann::json SemanticTokenCache::delta(Doc& doc, std::string const& previous_result_id)
+{
+    auto pos = entries_.find(doc.uri());
+    if (pos == entries_.end() || pos->second.result_id != previous_result_id) {
+        return full(doc);
+    }
+
+    std::vector<uint32_t> previous = pos->second.data;
+    auto& entry = update_(doc);
+    auto const& data = entry.data;
+
+    // one edit replacing everything between the common prefix and the common suffix
+    size_t prefix = 0;
+    while (prefix < previous.size() && prefix < data.size() && previous[prefix] == data[prefix]) {
+        ++prefix;
+    }
+    size_t suffix = 0;
+    while (suffix < previous.size() - prefix && suffix < data.size() - prefix &&
+           previous[previous.size() - 1 - suffix] == data[data.size() - 1 - suffix]) {
+        ++suffix;
+    }
+
+    nlohmann::json edits = nlohmann::json::array();
+    if (prefix != previous.size() || prefix != data.size()) {
+        edits.push_back({
+            {"start", prefix},
+            {"deleteCount", previous.size() - prefix - suffix},
+            {"data", std::vector<uint32_t>(data.begin() + prefix, data.end() - suffix)},
+        });
+    }
+
+    return {{"resultId", entry.result_id}, {"edits", edits}};
+}
+
+nlohmann::json SemanticTokenCache::range(Doc& doc, const int start_line, const int end_line)
+{
+    auto& entry = update_(doc);
+    auto const& tokens = entry.tokens;
+    auto first = std::lower_bound(tokens.begin(), tokens.end(), start_line,
+                                  [](Token const& token, int line) { return token.line < line; });
+    auto last = std::upper_bound(first, tokens.end(), end_line,
+                                 [](int line, Token const& token) { return line < token.line; });
+
+    std::vector<uint32_t> data;
+    encode_(doc.lines(), first, last, data);
+    return {{"data", data}};
 }
@@ -1,9 +1,68 @@
 #ifndef __GLSLX_SEMANTIC_TOKEN_HPP__
 #define __GLSLX_SEMANTIC_TOKEN_HPP__
 
+#include "lsp_defs.hpp"
 #include "nlohmann/json.hpp"
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
 
 class Doc;
-extern nlohmann::json semantic_token(Doc*);
+
+// semantic tokens of the open documents. the lexeme stream of a document is kept per text version and
+// the classified tokens per version and parse, so that a request for an unchanged document only encodes,
+// and full/delta only sends what changed since the previous result.
+class SemanticTokenCache {
+public:
+    // SemanticTokens with a resultId
+    nlohmann::json full(Doc& doc);
+    // SemanticTokensDelta against previous_result_id, or SemanticTokens if that is not the last result
+    nlohmann::json delta(Doc& doc, std::string const& previous_result_id);
+    // tokens of lines [start_line, end_line], 0-based
+    nlohmann::json range(Doc& doc, const int start_line, const int end_line);
+    void remove(std::string const& uri) { entries_.erase(uri); }
+    // tokens are lexed in bytes and sent in this encoding
+    void set_position_encoding(PositionEncoding encoding) { encoding_ = encoding; }
+
+private:
+    struct Lexeme {
+        enum class Kind : uint8_t { IDENTIFIER, NUMBER, COMMENT, DIRECTIVE, MACRO };
+
+        int line;
+        int column;
+        int length;
+        Kind kind;
+    };
+
+    struct Token {
+        int line;
+        int column;
+        int length;
+        int type;
+        int modifiers;
+    };
+
+    struct Entry {
+        int lexed_version = -1;
+        std::vector<Lexeme> lexemes;
+        int version = -1;
+        uint64_t parse_id = 0;
+        std::vector<Token> tokens;
+        // tokens encoded as the protocol wants them
+        std::vector<uint32_t> data;
+        std::string result_id;
+    };
+
+    std::unordered_map<std::string, Entry> entries_;
+    uint64_t next_result_id_ = 0;
+    PositionEncoding encoding_ = PositionEncoding::UTF16;
+
+    Entry& update_(Doc& doc);
+    static void lex_(std::vector<std::string> const& lines, std::vector<Lexeme>& lexemes);
+    static void classify_(Doc& doc, std::vector<Lexeme> const& lexemes, std::vector<Token>& tokens);
+    void encode_(std::vector<std::string> const& lines, std::vector<Token>::const_iterator first,
+                 std::vector<Token>::const_iterator last, std::vector<uint32_t>& data) const;
+};
 
 #endif
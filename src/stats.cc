@@ -0,0 +1,165 @@
+#include "stats.hpp"
+#include <algorithm>
+#include <cinttypes>
+
+int LatencyHistogram::bucket_(uint64_t us)
+{
+    if (us < kSubCount) {
+        return static_cast<int>(us);
+    }
+
+    int magnitude = kSubBits;
+    while (magnitude < 63 && (us >> (magnitude + 1))) {
+        ++magnitude;
+    }
+
+    // us >> (magnitude - kSubBits) is in [kSubCount, 2 * kSubCount)
+    auto sub = static_cast<int>(us >> (magnitude - kSubBits)) - kSubCount;
+    return (magnitude - kSubBits + 1) * kSubCount + sub;
+}
+
+uint64_t LatencyHistogram::upper_(int bucket)
+{
+    if (bucket < kSubCount) {
+        return bucket;
+    }
+
+    int shift = bucket / kSubCount - 1;
+    uint64_t sub = bucket % kSubCount;
+    uint64_t lower = (kSubCount + sub) << shift;
+    return lower + ((uint64_t(1) << shift) - 1);
+}
+
+void LatencyHistogram::record(uint64_t us)
+{
+    buckets_[bucket_(us)].fetch_add(1, std::memory_order_relaxed);
+    count_.fetch_add(1, std::memory_order_relaxed);
+    sum_.fetch_add(us, std::memory_order_relaxed);
+
+    auto max = max_.load(std::memory_order_relaxed);
+    while (us > max && !max_.compare_exchange_weak(max, us, std::memory_order_relaxed)) {
+    }
+}
+
+double LatencyHistogram::mean() const
+{
+    auto n = count();
+    return n ? double(sum_.load(std::memory_order_relaxed)) / n : 0.0;
+}
+
+uint64_t LatencyHistogram::percentile(double q) const
+{
+    auto n = count();
+    if (n == 0) {
+        return 0;
+    }
+
+    auto rank = static_cast<uint64_t>(q * n + 0.5);
+    rank = std::max<uint64_t>(1, std::min(rank, n));
+    uint64_t seen = 0;
+    for (int i = 0; i < kBuckets; ++i) {
+        seen += buckets_[i].load(std::memory_order_relaxed);
+        if (seen >= rank) {
+            return std::min(upper_(i), max());
+        }
+    }
+
+    return max();
+}
+
+nlohmann::json LatencyHistogram::json() const
+{
+    return {
+        {"count", count()},
+        {"meanUs", mean()},
+        {"p50Us", percentile(0.5)},
+        {"p90Us", percentile(0.9)},
+        {"p99Us", percentile(0.99)},
+        {"maxUs", max()},
+    };
+}
+
+Stats& Stats::get()
+{
+    // never destroyed, the writer and parse threads may still record while statics are torn down
+    static Stats* stats = new Stats;
+    return *stats;
+}
+
+template <typename T> static T& find_or_create(std::mutex& mutex, std::map<std::string, std::unique_ptr<T>>& map,
+                                                std::string const& name)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    auto& p = map[name];
+    if (!p) {
+        p = std::make_unique<T>();
+    }
+    return *p;
+}
+
+LatencyHistogram& Stats::method(std::string const& name) { return find_or_create(mutex_, methods_, name); }
+
+LatencyHistogram& Stats::phase(std::string const& name) { return find_or_create(mutex_, phases_, name); }
+
+std::atomic<uint64_t>& Stats::counter(std::string const& name) { return find_or_create(mutex_, counters_, name); }
+
+Stats::Cache& Stats::cache(std::string const& name) { return find_or_create(mutex_, caches_, name); }
+
+nlohmann::json Stats::json()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto uptime = std::chrono::steady_clock::now() - start_;
+    nlohmann::json result = {
+        {"uptimeMs", std::chrono::duration_cast<std::chrono::milliseconds>(uptime).count()},
+        {"methods", nlohmann::json::object()},
+        {"phases", nlohmann::json::object()},
+        {"counters", nlohmann::json::object()},
+        {"caches", nlohmann::json::object()},
+    };
+
+    for (auto const& [name, histogram] : methods_) {
+        result["methods"][name] = histogram->json();
+    }
+    for (auto const& [name, histogram] : phases_) {
+        result["phases"][name] = histogram->json();
+    }
+    for (auto const& [name, counter] : counters_) {
+        result["counters"][name] = counter->load(std::memory_order_relaxed);
+    }
+    for (auto const& [name, cache] : caches_) {
+        auto hits = cache->hits.load(std::memory_order_relaxed);
+        auto misses = cache->misses.load(std::memory_order_relaxed);
+        result["caches"][name] = {
+            {"hits", hits},
+            {"misses", misses},
+            {"hitRate", hits + misses ? double(hits) / double(hits + misses) : 0.0},
+        };
+    }
+
+    return result;
+}
+
+void Stats::dump(FILE* fp)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    using Histograms = std::map<std::string, std::unique_ptr<LatencyHistogram>>;
+    auto dump_histograms = [fp](const char* kind, Histograms const& histograms) {
+        for (auto const& [name, h] : histograms) {
+            fprintf(fp, "%s %-40s count %8" PRIu64 " p50 %8" PRIu64 "us p99 %8" PRIu64 "us max %8" PRIu64 "us\n",
+                    kind, name.c_str(), h->count(), h->percentile(0.5), h->percentile(0.99), h->max());
+        }
+    };
+
+    dump_histograms("method", methods_);
+    dump_histograms("phase ", phases_);
+    for (auto const& [name, counter] : counters_) {
+        fprintf(fp, "count  %-40s %8" PRIu64 "\n", name.c_str(), counter->load(std::memory_order_relaxed));
+    }
+    for (auto const& [name, cache] : caches_) {
+        auto hits = cache->hits.load(std::memory_order_relaxed);
+        auto misses = cache->misses.load(std::memory_order_relaxed);
+        fprintf(fp, "cache  %-40s hits %8" PRIu64 " misses %8" PRIu64 " hit rate %.3f\n", name.c_str(), hits, misses,
+                hits + misses ? double(hits) / double(hits + misses) : 0.0);
+    }
+    fflush(fp);
+}
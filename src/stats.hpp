@@ -0,0 +1,97 @@
+#ifndef __GLSLX_STATS_HPP__
+#define __GLSLX_STATS_HPP__
+#include "nlohmann/json.hpp"
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+
+// latencies in microseconds in log-linear buckets like HdrHistogram: values below 2^kSubBits are exact,
+// every power of two above is split into 2^kSubBits buckets, which bounds the relative error by 1/32.
+// recording is a few relaxed atomic adds, any thread may record while another one reads.
+class LatencyHistogram {
+public:
+    void record(uint64_t us);
+
+    uint64_t count() const { return count_.load(std::memory_order_relaxed); }
+    uint64_t max() const { return max_.load(std::memory_order_relaxed); }
+    double mean() const;
+    // the value q of the recorded values are below, q in [0, 1], rounded up to its bucket
+    uint64_t percentile(double q) const;
+    nlohmann::json json() const;
+
+private:
+    static constexpr int kSubBits = 5;
+    static constexpr int kSubCount = 1 << kSubBits;
+    static constexpr int kBuckets = (64 - kSubBits + 1) * kSubCount;
+
+    std::array<std::atomic<uint64_t>, kBuckets> buckets_{};
+    std::atomic<uint64_t> count_{0};
+    std::atomic<uint64_t> sum_{0};
+    std::atomic<uint64_t> max_{0};
+
+    static int bucket_(uint64_t us);
+    // largest value of a bucket
+    static uint64_t upper_(int bucket);
+};
+
+// where the time goes: latency per LSP method and per phase of the work behind them, event counters and
+// cache hit rates. histograms and counters are created on first use and never removed, so callers on hot
+// paths look them up once and keep the reference.
+class Stats {
+public:
+    struct Cache {
+        std::atomic<uint64_t> hits{0};
+        std::atomic<uint64_t> misses{0};
+
+        void access(bool hit) { (hit ? hits : misses).fetch_add(1, std::memory_order_relaxed); }
+    };
+
+    static Stats& get();
+
+    // handling of a request or notification, lock wait included
+    LatencyHistogram& method(std::string const& name);
+    // preprocess, parse, extract and serialize
+    LatencyHistogram& phase(std::string const& name);
+    std::atomic<uint64_t>& counter(std::string const& name);
+    Cache& cache(std::string const& name);
+
+    // the answer to $/glslx/stats
+    nlohmann::json json();
+    // one line per method, phase, counter and cache
+    void dump(FILE* fp);
+
+private:
+    std::chrono::steady_clock::time_point start_ = std::chrono::steady_clock::now();
+    std::mutex mutex_;
+    std::map<std::string, std::unique_ptr<LatencyHistogram>> methods_;
+    std::map<std::string, std::unique_ptr<LatencyHistogram>> phases_;
+    std::map<std::string, std::unique_ptr<std::atomic<uint64_t>>> counters_;
+    std::map<std::string, std::unique_ptr<Cache>> caches_;
+};
+
+// records the lifetime of the timer into a histogram
+class ScopedTimer {
+public:
+    explicit ScopedTimer(LatencyHistogram& histogram)
+        : histogram_(histogram), start_(std::chrono::steady_clock::now())
+    {
+    }
+    ScopedTimer(const ScopedTimer&) = delete;
+    ScopedTimer& operator=(const ScopedTimer&) = delete;
+    ~ScopedTimer()
+    {
+        auto elapsed = std::chrono::steady_clock::now() - start_;
+        histogram_.record(std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count());
+    }
+
+private:
+    LatencyHistogram& histogram_;
+    std::chrono::steady_clock::time_point start_;
+};
+#endif
@@ -1,10 +1,13 @@
 #include "workspace.hpp"
 #include "args.hpp"
 #include "doc.hpp"
+#include "include_cache.hpp"
 #include "nlohmann/json.hpp"
+#include <algorithm>
 #include <cstdio>
 #include <filesystem>
 #include <iostream>
+#include <set>
 #include <tuple>
 #include <vector>
 
@@ -52,6 +55,7 @@ bool Workspace::init(std::string const& root)
 
     // parse compile parameters
     parse_compile_options(compile_commands);
+    index_.start(compile_options_, (fs::path(root_) / ".glslx" / "index.bin").string());
     return true;
 }
 
@@ -80,6 +84,7 @@ const CompileOption& Workspace::get_compile_option(std::string const& uri) { ret
 
 void Workspace::set_root(std::string const& root) { root_ = root; }
 std::string const& Workspace::get_root() const { return root_; }
+
 void Workspace::update_doc(std::string const& uri, const int version, std::string const& text)
 {
     if (docs_.count(uri) > 0) {
@@ -87,51 +92,307 @@ void Workspace::update_doc(std::string const& uri, const int version, std::strin
     } else {
         add_doc(Doc(uri, version, text));
     }
+
+    IncludeCache::get().update(uri_to_path(uri), text);
 }
 
-std::tuple<bool, Doc*> Workspace::save_doc(std::string const& uri, const int version)
+void Workspace::update_doc(std::string const& uri, const int version,
+                           std::vector<TextDocumentContentChangeEvent> const& changes)
 {
     if (docs_.count(uri) > 0) {
         auto& doc = docs_[uri];
-        if (doc.version() == version) {
-            bool ret = doc.parse();
-            return std::make_tuple(ret, &doc);
+        doc.update(version, changes, position_encoding_);
+        IncludeCache::get().update(uri_to_path(uri), doc.text());
+        return;
+    }
+
+    // an incremental change can only be applied to a known document
+    if (!changes.empty() && !changes.back().has_range) {
+        add_doc(Doc(uri, version, changes.back().text, get_compile_option(uri)));
+    } else {
+        fprintf(stderr, "incremental change for unknown document %s\n", uri.c_str());
+    }
+}
+
+bool Workspace::install_doc(Doc&& parsed, bool success)
+{
+    auto pos = docs_.find(parsed.uri());
+    if (pos == docs_.end()) {
+        return false;
+    }
+
+    if (success) {
+        pos->second.adopt(std::move(parsed));
+        last_used_[pos->first] = ++clock_;
+        rehydrated_.erase(pos->first);
+        enforce_memory_budget_(pos->first);
+    } else {
+        pos->second.adopt_preprocess(parsed);
+        pos->second.set_info_log(parsed.info_log());
+        pos->second.set_diagnostics(parsed.diagnostics(), parsed.diagnostics_key());
+    }
+    encode_diagnostics_(pos->second);
+    return true;
+}
+
+void Workspace::encode_diagnostics_(Doc& doc)
+{
+    if (position_encoding_ == PositionEncoding::UTF8 || doc.diagnostics().empty()) {
+        return;
+    }
+
+    auto diagnostics = doc.diagnostics();
+    for (auto& diagnostic : diagnostics) {
+        diagnostic.range = client_range(diagnostic.uri, diagnostic.range);
+    }
+    doc.set_diagnostics(diagnostics, doc.diagnostics_key());
+}
+
+std::string Workspace::line_text_(std::string const& uri, const int line)
+{
+    if (line < 0) {
+        return {};
+    }
+
+    auto pos = docs_.find(uri);
+    if (pos != docs_.end()) {
+        auto const& lines = pos->second.lines();
+        return line < (int)lines.size() ? lines[line] : std::string();
+    }
+
+    // a header that is not open, as the parses read it
+    auto file = IncludeCache::get().load(uri_to_path(uri));
+    if (!file) {
+        return {};
+    }
+
+    auto const& content = file->content;
+    size_t start = 0;
+    for (int i = 0; i < line; ++i) {
+        start = content.find('\n', start);
+        if (start == std::string::npos) {
+            return {};
         }
-        return std::make_tuple(true, &doc);
+        ++start;
+    }
+
+    auto end = content.find('\n', start);
+    return content.substr(start, end == std::string::npos ? std::string::npos : end - start);
+}
+
+int Workspace::byte_column(std::string const& uri, const int line, const int character)
+{
+    if (position_encoding_ == PositionEncoding::UTF8) {
+        return character;
     }
 
-    return std::make_tuple(true, nullptr);
+    return utf8_column(line_text_(uri, line), character, position_encoding_);
 }
 
-void Workspace::add_doc(Doc&& doc) { docs_[doc.uri()] = std::move(doc); }
+Range Workspace::client_range(std::string const& uri, Range range)
+{
+    if (position_encoding_ == PositionEncoding::UTF8) {
+        return range;
+    }
+
+    auto start = line_text_(uri, range.start.line);
+    range.start.character = client_column(start, range.start.character, position_encoding_);
+    auto end = range.end.line == range.start.line ? start : line_text_(uri, range.end.line);
+    range.end.character = client_column(end, range.end.character, position_encoding_);
+    return range;
+}
+
+void Workspace::close_doc(std::string const& uri)
+{
+    docs_.erase(uri);
+    last_used_.erase(uri);
+    rehydrated_.erase(uri);
+
+    // unsaved edits of a header are gone with the buffer
+    IncludeCache::get().invalidate(uri_to_path(uri));
+
+    // the file on disk may differ from the buffer the index saw last
+    auto pos = compile_options_.find(uri);
+    if (pos != compile_options_.end()) {
+        index_.reindex(uri, pos->second);
+    } else {
+        index_.remove(uri);
+    }
+}
+
+void Workspace::set_memory_budget(size_t bytes)
+{
+    memory_budget_ = bytes;
+    enforce_memory_budget_({});
+}
 
-std::vector<Doc::LookupResult> Workspace::lookup_nodes_at(std::string const& uri, const int line, const int col)
+void Workspace::enforce_memory_budget_(std::string const& keep)
 {
-    if (docs_.count(uri)) {
-        return docs_[uri].lookup_nodes_at(line, col);
+    size_t total = 0;
+    for (auto const& [uri, doc] : docs_) {
+        total += doc.memory_usage();
     }
-    return {};
+
+    while (total > memory_budget_) {
+        Doc* coldest = nullptr;
+        uint64_t coldest_used = UINT64_MAX;
+        for (auto& [uri, doc] : docs_) {
+            uint64_t used = last_used_[uri];
+            if (uri != keep && doc.memory_usage() > 0 && used < coldest_used) {
+                coldest = &doc;
+                coldest_used = used;
+            }
+        }
+
+        if (!coldest) {
+            break;
+        }
+
+        total -= coldest->memory_usage();
+        coldest->release_ir();
+    }
+}
+
+void Workspace::save_doc(std::string const& uri)
+{
+    // the header on disk matches the editor again
+    IncludeCache::get().invalidate(uri_to_path(uri));
+}
+
+std::vector<std::string> Workspace::get_dependents(std::string const& uri)
+{
+    auto path = uri_to_path(uri);
+    std::vector<std::string> dependents;
+    for (auto const& [doc_uri, doc] : docs_) {
+        if (doc_uri != uri && doc.includes(path)) {
+            dependents.push_back(doc_uri);
+        }
+    }
+
+    return dependents;
 }
 
-glslang::TSourceLoc Workspace::locate_symbol_def(std::string const& uri, const int line, const int col)
+void Workspace::add_doc(Doc&& doc)
+{
+    // files including the document read its buffer until it is saved or closed
+    IncludeCache::get().update(uri_to_path(doc.uri()), doc.text());
+    docs_[doc.uri()] = std::move(doc);
+}
+
+std::vector<std::string> Workspace::doc_uris() const
+{
+    std::vector<std::string> uris;
+    uris.reserve(docs_.size());
+    for (auto const& [uri, doc] : docs_) {
+        uris.push_back(uri);
+    }
+    return uris;
+}
+
+bool Workspace::locate_symbol_def(std::string const& uri, const int line, const int col, Location& location)
+{
+    auto* doc = get_doc(uri);
+    auto const* ir = doc ? doc->ir() : nullptr;
+    if (!ir)
+        return false;
+
+    for (auto const& occurrence : ir->lookup(line, col)) {
+        DocIR::Loc decl;
+        if (occurrence.kind == DocIR::Occurrence::Kind::SYMBOL) {
+            decl = ir->symbols()[occurrence.target].decl;
+        } else if (occurrence.kind == DocIR::Occurrence::Kind::FIELD) {
+            decl = ir->fields()[occurrence.target].loc;
+        } else if (occurrence.kind == DocIR::Occurrence::Kind::TYPE) {
+            decl = ir->structs()[occurrence.target].loc;
+        }
+
+        // built-ins are declared nowhere
+        if (decl.line == 0 || decl.file == 0) {
+            return false;
+        }
+
+        Position start = {decl.line - 1, decl.column - 1};
+        location = {ir->str(decl.file), {start, start}};
+        return true;
+    }
+
+    return false;
+}
+
+std::vector<IndexSymbol> Workspace::locate_indexed_defs(std::string const& uri, const int line, const int col)
 {
     if (docs_.count(uri) <= 0)
-        return {nullptr, 0, 0};
-
-    auto nodes = lookup_nodes_at(uri, line, col);
-    auto* func = docs_[uri].lookup_func_by_line(line);
-
-    for (auto& node : nodes) {
-        if (node.kind == Doc::LookupResult::Kind::SYMBOL) {
-            return docs_[uri].locate_symbol_def(func, node.sym);
-        } else if (node.kind == Doc::LookupResult::Kind::FIELD) {
-            return node.field.loc;
-        } else if (node.kind == Doc::LookupResult::Kind::TYPE) {
-            return docs_[uri].locate_userdef_type(line, node.ty);
+        return {};
+
+    const auto& lines = docs_[uri].lines();
+    if (line <= 0 || line > lines.size()) {
+        return {};
+    }
+
+    std::string const& text = lines[line - 1];
+    auto is_ident = [](char c) { return isalnum(static_cast<unsigned char>(c)) || c == '_'; };
+    int start = std::min<int>(col - 1, text.size());
+    int end = start;
+    while (start > 0 && is_ident(text[start - 1]))
+        --start;
+    while (end < text.size() && is_ident(text[end]))
+        ++end;
+
+    if (start == end) {
+        return {};
+    }
+
+    return index_.lookup(text.substr(start, end - start));
+}
+
+std::vector<Location> Workspace::references(std::string const& uri, const int line, const int col,
+                                            bool include_declaration)
+{
+    auto* doc = get_doc(uri);
+    auto const* ir = doc ? doc->ir() : nullptr;
+    if (!ir)
+        return {};
+
+    auto* symbol = ir->lookup_symbol(line, col);
+    if (!symbol) {
+        return {};
+    }
+
+    std::vector<Location> locations;
+    std::set<std::tuple<std::string, int, int>> seen;
+    auto const& name = ir->str(symbol->name);
+    const int length = name.size();
+    auto add = [&locations, &seen, length](std::string const& file, const int line, const int col) {
+        if (file.empty()) {
+            return;
+        }
+        // headers are reported by their path
+        auto file_uri = path_to_uri(file);
+        if (!seen.emplace(file_uri, line, col).second) {
+            return;
+        }
+        locations.push_back({file_uri, {{line - 1, col - 1}, {line - 1, col - 1 + length}}});
+    };
+
+    auto const& decl_file = ir->str(symbol->decl.file);
+    if (include_declaration) {
+        add(decl_file, symbol->decl.line, symbol->decl.column);
+    }
+
+    for (auto const& loc : symbol->uses) {
+        add(ir->str(loc.file), loc.line, loc.column);
+    }
+
+    // other files use the declarations of a header, also when the header itself is asked
+    if (symbol->global && !decl_file.empty()) {
+        auto decl_path = uri_to_path(decl_file);
+        for (auto const& ref :
+             index_.lookup_references(name, decl_path, symbol->decl.line, symbol->decl.column, uri)) {
+            add(ref.file, ref.line, ref.column);
         }
     }
 
-    return {nullptr, 0, 0};
+    return locations;
 }
 
 std::string Workspace::get_sentence(std::string const& uri, const int line, const int col, int breakc)
@@ -140,6 +401,10 @@ std::string Workspace::get_sentence(std::string const& uri, const int line, cons
         return "";
 
     const auto& lines = docs_[uri].lines();
+    if (line < 0 || line >= lines.size()) {
+        return {};
+    }
+
     std::string const& text = lines[line];
     if (text.size() < col) {
         return {};
@@ -157,38 +422,31 @@ std::string Workspace::get_sentence(std::string const& uri, const int line, cons
     return prefix;
 }
 
-std::vector<glslang::TIntermSymbol*>
-Workspace::lookup_symbols_by_prefix(std::string const& uri, Doc::FunctionDefDesc* func, std::string const& prefix)
+Doc* Workspace::get_doc(std::string const& uri)
 {
-    auto syms = docs_[uri].lookup_symbols_by_prefix(func, prefix);
-    for (auto* sym : syms) {
-        fprintf(stderr, "find symbol: %s\n", sym->getName().c_str());
-    }
-    return syms;
+    if (docs_.count(uri) > 0)
+        return &docs_[uri];
+    else
+        return nullptr;
 }
 
-glslang::TIntermSymbol* Workspace::lookup_symbol_by_name(std::string const& uri, Doc::FunctionDefDesc* func,
-                                                         std::string const& name)
+Doc* Workspace::use_doc(std::string const& uri, bool* rehydrate)
 {
-    if (docs_.count(uri) <= 0) {
+    auto pos = docs_.find(uri);
+    if (pos == docs_.end()) {
         return nullptr;
     }
 
-    auto& doc = docs_[uri];
-    return doc.lookup_symbol_by_name(func, name);
-}
-
-Doc::FunctionDefDesc* Workspace::get_func_by_line(const std::string& uri, const int line)
-{
-    if (docs_.count(uri) <= 0)
-        return nullptr;
-    return docs_[uri].lookup_func_by_line(line);
-}
+    auto& doc = pos->second;
+    last_used_[uri] = ++clock_;
+    if (rehydrate) {
+        // a version that failed to parse would fail again, it is asked for once
+        auto asked = rehydrated_.find(uri);
+        *rehydrate = doc.evicted() && (asked == rehydrated_.end() || asked->second != doc.version());
+        if (*rehydrate) {
+            rehydrated_[uri] = doc.version();
+        }
+    }
 
-Doc* Workspace::get_doc(std::string const& uri)
-{
-    if (docs_.count(uri) > 0)
-        return &docs_[uri];
-    else
-        return nullptr;
+    return &doc;
 }
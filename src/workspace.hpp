@@ -2,6 +2,7 @@
 #define __GLSLX_WORKSPACE_HPP__
 #include "args.hpp"
 #include "doc.hpp"
+#include "workspace_index.hpp"
 #include <map>
 #include <vector>
 
@@ -15,10 +16,26 @@ class Workspace {
 
     std::string root_;
     std::map<std::string, Doc> docs_;
+    // when each open document was last queried or parsed, the least recent loses its IR first
+    std::map<std::string, uint64_t> last_used_;
+    uint64_t clock_ = 0;
+    // version of each evicted document its parse was last asked for
+    std::map<std::string, int> rehydrated_;
+    // bytes the IRs of the open documents may take together
+    size_t memory_budget_ = kDefaultMemoryBudget;
+    // of every position exchanged with the client
+    PositionEncoding position_encoding_ = PositionEncoding::UTF16;
     std::map<std::string, CompileOption> compile_options_;
+    WorkspaceIndex index_;
     void parse_compile_options(std::vector<CompileCommand> const& compile_commands);
+    void enforce_memory_budget_(std::string const& keep);
+    std::string line_text_(std::string const& uri, const int line);
+    // turns the byte columns glslang reports into the negotiated encoding
+    void encode_diagnostics_(Doc& doc);
 
 public:
+    static constexpr size_t kDefaultMemoryBudget = 512ull << 20;
+
     Workspace();
     Workspace(const Workspace&) = delete;
     Workspace(Workspace&&) = delete;
@@ -28,20 +45,41 @@ public:
     bool init(std::string const& root);
 
     void update_doc(std::string const& uri, const int version, std::string const& text);
+    void update_doc(std::string const& uri, const int version,
+                    std::vector<TextDocumentContentChangeEvent> const& changes);
     void add_doc(Doc&& doc);
-    std::tuple<bool, Doc*> save_doc(std::string const& uri, const int version);
+    // false if the document was closed meanwhile
+    bool install_doc(Doc&& parsed, bool success);
+    void save_doc(std::string const& uri);
+    void close_doc(std::string const& uri);
+    void set_memory_budget(size_t bytes);
+    void set_position_encoding(PositionEncoding encoding) { position_encoding_ = encoding; }
+    PositionEncoding position_encoding() const { return position_encoding_; }
+    // byte column of a Position.character on a 0-based line of an open document
+    int byte_column(std::string const& uri, const int line, const int character);
+    // a range with byte columns in uri, an open document or a file, in the negotiated encoding
+    Range client_range(std::string const& uri, Range range);
+    // open documents including the header at uri
+    std::vector<std::string> get_dependents(std::string const& uri);
+    // the document as it is, its IR may have been released
     Doc* get_doc(std::string const& uri);
+    // the document, marked as recently used. rehydrate tells whether its IR was released and should be
+    // scheduled for a parse, the answers meanwhile come from what is left
+    Doc* use_doc(std::string const& uri, bool* rehydrate = nullptr);
+    std::vector<std::string> doc_uris() const;
     std::string const& get_root() const;
     void set_root(std::string const& root);
-    glslang::TSourceLoc locate_symbol_def(std::string const& uri, const int line, const int col);
-    std::vector<Doc::LookupResult> lookup_nodes_at(std::string const& uri, const int line, const int col);
+    // declaration of the symbol, field or type at line:col
+    bool locate_symbol_def(std::string const& uri, const int line, const int col, Location& location);
+    // declarations in the workspace index named like the identifier at line:col
+    std::vector<IndexSymbol> locate_indexed_defs(std::string const& uri, const int line, const int col);
+    // uses of the symbol at line:col, in the document and, for globals and functions declared in a header,
+    // in every indexed file including it
+    std::vector<Location> references(std::string const& uri, const int line, const int col,
+                                     bool include_declaration);
 
-    Doc::FunctionDefDesc* get_func_by_line(std::string const& uri, const int line);
-    glslang::TIntermSymbol* lookup_symbol_by_name(std::string const& uri, Doc::FunctionDefDesc* func,
-                                                  std::string const& name);
-    std::vector<glslang::TIntermSymbol*> lookup_symbols_by_prefix(std::string const& uri, Doc::FunctionDefDesc* func,
-                                                                  std::string const& prefix);
     std::string get_sentence(std::string const& uri, const int line, const int col, int breakc = ';');
     const CompileOption& get_compile_option(std::string const& uri);
+    WorkspaceIndex& index() { return index_; }
 };
 #endif
@@ -0,0 +1,579 @@
+#include "workspace_index.hpp"
+#include "doc.hpp"
+#include "fuzzy_match.hpp"
+#include "include_cache.hpp"
+#include "index_store.hpp"
+#include "preprocess.hpp"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+
+static uint64_t stable_hash(uint64_t seed, int64_t value)
+{
+    return stable_hash(reinterpret_cast<const char*>(&value), sizeof(value), seed);
+}
+
+uint64_t fingerprint(CompileOption const& option)
+{
+    uint64_t hash = stable_hash(option.entrypoint);
+    for (auto const& [k, v] : option.macros) {
+        hash = stable_hash(k, hash);
+        hash = stable_hash(v, hash);
+    }
+
+    for (auto const& d : option.include_dirs) {
+        hash = stable_hash(d, hash);
+    }
+
+    hash = stable_hash(hash, option.version);
+    hash = stable_hash(hash, option.profile);
+    hash = stable_hash(hash, option.shader_stage);
+    hash = stable_hash(hash, option.client);
+    hash = stable_hash(hash, option.client_version);
+    hash = stable_hash(hash, option.target_spv);
+    hash = stable_hash(hash, option.language);
+    return hash;
+}
+
+static IndexSymbol make_symbol(IndexSymbol::Kind kind, DocIR const& ir, DocIR::StrId name, DocIR::StrId detail,
+                               DocIR::Loc const& loc)
+{
+    return {kind, ir.str(name), ir.str(detail), ir.str(loc.file), loc.line, loc.column, loc.line, loc.column};
+}
+
+FileIndex make_file_index(Doc& doc)
+{
+    FileIndex index;
+    index.uri = doc.uri();
+    const char* text = doc.text();
+    index.hash = stable_hash(text, strlen(text));
+    index.option_hash = fingerprint(doc.option());
+    index.inactive_blocks = doc.inactive_blocks();
+    index.includes = doc.includes();
+
+    auto const* ir = doc.ir();
+    if (!ir) {
+        return index;
+    }
+
+    for (auto const& symbol : ir->symbols()) {
+        auto const& name = ir->str(symbol.name);
+        // members of anonymous blocks are found through the block
+        if (!symbol.global || name.compare(0, 5, "anon@") == 0) {
+            continue;
+        }
+
+        if (symbol.kind == DocIR::Symbol::Kind::VARIABLE) {
+            index.symbols.push_back(make_symbol(IndexSymbol::Kind::Global, *ir, symbol.name, symbol.type, symbol.decl));
+        }
+
+        // uses of a declaration of another file, a header the file includes
+        auto const& decl_file = ir->str(symbol.decl.file);
+        if (decl_file.empty() || decl_file == index.uri) {
+            continue;
+        }
+        for (auto const& loc : symbol.uses) {
+            index.refs.push_back(
+                {name, decl_file, symbol.decl.line, symbol.decl.column, ir->str(loc.file), loc.line, loc.column});
+        }
+    }
+
+    for (auto const& function : ir->functions()) {
+        auto const& symbol = ir->symbols()[function.symbol];
+        auto indexed = make_symbol(IndexSymbol::Kind::Function, *ir, symbol.name, symbol.type, function.start);
+        indexed.end_line = function.end.line;
+        indexed.end_column = function.end.column;
+        index.symbols.push_back(std::move(indexed));
+    }
+
+    for (auto const& s : ir->structs()) {
+        if (s.scope == DocIR::kNone && s.loc.line > 0) {
+            index.symbols.push_back(make_symbol(IndexSymbol::Kind::Struct, *ir, s.name, s.type, s.loc));
+        }
+    }
+
+    return index;
+}
+
+static char lower_char(char c) { return (c >= 'A' && c <= 'Z') ? c - 'A' + 'a' : c; }
+
+static std::string to_lower(std::string_view s)
+{
+    std::string lower(s);
+    std::transform(lower.begin(), lower.end(), lower.begin(), lower_char);
+    return lower;
+}
+
+// a gram of 1 to 3 characters and its length packed in 32 bits
+static uint32_t gram(std::string_view s)
+{
+    uint32_t code = static_cast<uint32_t>(s.size()) << 24;
+    for (size_t i = 0; i < s.size(); ++i) {
+        code |= static_cast<uint32_t>(static_cast<unsigned char>(s[i])) << (16 - 8 * i);
+    }
+    return code;
+}
+
+static std::string location_key(IndexSymbol const& symbol)
+{
+    return symbol.file + ":" + std::to_string(symbol.line) + ":" + std::to_string(symbol.column) + ":" +
+           symbol.name;
+}
+
+void SymbolSearch::add(FileIndex const& file)
+{
+    remove(file.uri);
+
+    auto& owned = by_uri_[file.uri];
+    for (auto const& symbol : file.symbols) {
+        auto key = location_key(symbol);
+        auto pos = by_location_.find(key);
+        if (pos == by_location_.end()) {
+            auto slot = static_cast<uint32_t>(slots_.size());
+            slots_.push_back({symbol, to_lower(symbol.name), 1});
+            by_location_.emplace(std::move(key), slot);
+            post_(slot);
+            owned.push_back(slot);
+            continue;
+        }
+
+        auto slot = pos->second;
+        if (std::find(owned.begin(), owned.end(), slot) != owned.end()) {
+            continue;
+        }
+
+        // a dead slot is still on its posting lists
+        auto& s = slots_[slot];
+        if (s.refs++ == 0) {
+            --dead_;
+        }
+        s.symbol = symbol;
+        owned.push_back(slot);
+    }
+}
+
+void SymbolSearch::remove(std::string const& uri)
+{
+    auto pos = by_uri_.find(uri);
+    if (pos == by_uri_.end()) {
+        return;
+    }
+
+    for (auto slot : pos->second) {
+        if (--slots_[slot].refs == 0) {
+            ++dead_;
+        }
+    }
+    by_uri_.erase(pos);
+
+    if (dead_ > slots_.size() - dead_) {
+        compact_();
+    }
+}
+
+void SymbolSearch::post_(uint32_t slot)
+{
+    std::string_view lower = slots_[slot].lower;
+    std::vector<uint32_t> grams;
+    for (size_t n = 1; n <= 3; ++n) {
+        for (size_t i = 0; i + n <= lower.size(); ++i) {
+            grams.push_back(gram(lower.substr(i, n)));
+        }
+    }
+
+    std::sort(grams.begin(), grams.end());
+    grams.erase(std::unique(grams.begin(), grams.end()), grams.end());
+    for (auto g : grams) {
+        postings_[g].push_back(slot);
+    }
+}
+
+void SymbolSearch::compact_()
+{
+    std::vector<uint32_t> remap(slots_.size(), UINT32_MAX);
+    std::vector<Slot> slots;
+    slots.reserve(slots_.size() - dead_);
+    for (uint32_t i = 0; i < slots_.size(); ++i) {
+        if (slots_[i].refs > 0) {
+            remap[i] = static_cast<uint32_t>(slots.size());
+            slots.push_back(std::move(slots_[i]));
+        }
+    }
+
+    slots_ = std::move(slots);
+    dead_ = 0;
+    by_location_.clear();
+    postings_.clear();
+    for (uint32_t i = 0; i < slots_.size(); ++i) {
+        by_location_.emplace(location_key(slots_[i].symbol), i);
+        post_(i);
+    }
+
+    for (auto& [uri, owned] : by_uri_) {
+        for (auto& slot : owned) {
+            slot = remap[slot];
+        }
+    }
+}
+
+std::vector<IndexSymbol> SymbolSearch::search(std::string_view query, const size_t limit) const
+{
+    auto lower = to_lower(query);
+    TopK top(limit);
+    FuzzyMatcher matcher(query);
+
+    auto consider = [&](uint32_t slot) {
+        auto const& s = slots_[slot];
+        if (s.refs == 0 || s.lower.find(lower) == std::string::npos) {
+            return;
+        }
+        top.push({matcher.score(s.symbol.name), slot, slot});
+    };
+
+    if (lower.empty()) {
+        for (uint32_t slot = 0; slot < slots_.size(); ++slot) {
+            consider(slot);
+        }
+    } else {
+        // every name containing the query is on the list of each of its grams
+        const std::vector<uint32_t>* shortest = nullptr;
+        std::string_view q = lower;
+        size_t n = std::min<size_t>(q.size(), 3);
+        for (size_t i = 0; i + n <= q.size(); ++i) {
+            auto pos = postings_.find(gram(q.substr(i, n)));
+            if (pos == postings_.end()) {
+                return {};
+            }
+            if (!shortest || pos->second.size() < shortest->size()) {
+                shortest = &pos->second;
+            }
+        }
+
+        for (auto slot : *shortest) {
+            consider(slot);
+        }
+    }
+
+    std::vector<IndexSymbol> symbols;
+    for (auto const& item : top.take()) {
+        symbols.push_back(slots_[item.index].symbol);
+    }
+    return symbols;
+}
+
+WorkspaceIndex::~WorkspaceIndex() { stop(); }
+
+void WorkspaceIndex::start(std::map<std::string, CompileOption> const& files, std::string const& store_path,
+                           unsigned threads)
+{
+    std::vector<FileIndex> stored;
+    if (!store_path.empty() && load_index_store(store_path, stored)) {
+        fprintf(stderr, "index: loaded %zu files from %s\n", stored.size(), store_path.c_str());
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    store_path_ = store_path;
+    for (auto& file : stored) {
+        // files that left the compile commands are dropped
+        if (files.count(file.uri) > 0 && files_.count(file.uri) == 0) {
+            set_file_(std::make_shared<const FileIndex>(std::move(file)));
+        }
+    }
+
+    for (auto const& [uri, option] : files) {
+        jobs_.push_back({uri, option});
+    }
+
+    if (!workers_.empty() || jobs_.empty()) {
+        cv_.notify_all();
+        return;
+    }
+
+    if (threads == 0) {
+        // leave a core to the main thread and one to the parse worker
+        unsigned cores = std::thread::hardware_concurrency();
+        threads = cores > 3 ? cores - 2 : 1;
+    }
+
+    stop_ = false;
+    for (unsigned i = 0; i < threads; ++i) {
+        workers_.emplace_back([this]() { run_(); });
+    }
+}
+
+void WorkspaceIndex::stop()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stop_ = true;
+        jobs_.clear();
+    }
+    cv_.notify_all();
+
+    for (auto& worker : workers_) {
+        worker.join();
+    }
+    workers_.clear();
+
+    // keep what was indexed before the shutdown
+    save_();
+}
+
+void WorkspaceIndex::save_()
+{
+    std::lock_guard<std::mutex> store_lock(store_mutex_);
+    std::string path;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!dirty_ || store_path_.empty()) {
+            return;
+        }
+        dirty_ = false;
+        path = store_path_;
+    }
+
+    if (!save_index_store(path, files())) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        dirty_ = true;
+    }
+}
+
+void WorkspaceIndex::run_()
+{
+    for (;;) {
+        Job job;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            cv_.wait(lock, [this]() { return stop_ || !jobs_.empty(); });
+            if (stop_) {
+                return;
+            }
+
+            job = std::move(jobs_.front());
+            jobs_.pop_front();
+            ++active_;
+        }
+
+        index_file_(job);
+
+        bool idle;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            idle = --active_ == 0 && jobs_.empty();
+        }
+
+        if (idle) {
+            save_();
+        }
+    }
+}
+
+void WorkspaceIndex::index_file_(Job const& job)
+{
+    const std::string scheme = "file://";
+    std::string path = job.uri.compare(0, scheme.size(), scheme) == 0 ? job.uri.substr(scheme.size()) : job.uri;
+
+    std::ifstream ifs(path, std::ios::binary);
+    if (!ifs) {
+        fprintf(stderr, "index: failed to read %s\n", path.c_str());
+        return;
+    }
+
+    std::stringstream ss;
+    ss << ifs.rdbuf();
+    std::string text = ss.str();
+
+    uint64_t hash = stable_hash(text);
+    uint64_t option_hash = fingerprint(job.option);
+    if (auto indexed = get(job.uri)) {
+        bool up_to_date = indexed->hash == hash && indexed->option_hash == option_hash;
+        for (auto const& [include, include_hash] : indexed->includes) {
+            if (!up_to_date)
+                break;
+            up_to_date = IncludeCache::get().hash(include) == include_hash;
+        }
+
+        if (up_to_date) {
+            return;
+        }
+    }
+
+    Doc doc(job.uri, 0, text, job.option);
+    if (!doc.parse()) {
+        fprintf(stderr, "index: failed to parse %s\n", path.c_str());
+        return;
+    }
+
+    auto index = std::make_shared<const FileIndex>(make_file_index(doc));
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    // an editor parse of the file is newer than the disk
+    if (open_.count(job.uri) == 0) {
+        set_file_(std::move(index));
+        dirty_ = true;
+    }
+}
+
+void WorkspaceIndex::update(FileIndex&& index)
+{
+    auto file = std::make_shared<const FileIndex>(std::move(index));
+    std::lock_guard<std::mutex> lock(mutex_);
+    open_.insert(file->uri);
+    set_file_(std::move(file));
+    dirty_ = true;
+}
+
+void WorkspaceIndex::set_file_(std::shared_ptr<const FileIndex> file)
+{
+    search_.add(*file);
+    auto& entry = files_[file->uri];
+    if (entry) {
+        remove_postings_(*entry);
+    }
+    add_postings_(*file);
+    entry = std::move(file);
+}
+
+static std::string decl_key(std::string const& path, const int line, const int column)
+{
+    return path + ":" + std::to_string(line) + ":" + std::to_string(column);
+}
+
+void WorkspaceIndex::add_postings_(FileIndex const& file)
+{
+    for (uint32_t i = 0; i < file.symbols.size(); ++i) {
+        symbols_by_name_[file.symbols[i].name][file.uri].push_back(i);
+    }
+
+    for (uint32_t i = 0; i < file.refs.size(); ++i) {
+        auto const& ref = file.refs[i];
+        // the header is recorded as its include path, queries come with the path of the uri of the open header
+        refs_by_decl_[decl_key(uri_to_path(ref.decl_file), ref.decl_line, ref.decl_column)][file.uri].push_back(i);
+    }
+}
+
+void WorkspaceIndex::remove_postings_(FileIndex const& file)
+{
+    auto erase = [&file](auto& postings, std::string const& key) {
+        auto pos = postings.find(key);
+        if (pos == postings.end()) {
+            return;
+        }
+        pos->second.erase(file.uri);
+        if (pos->second.empty()) {
+            postings.erase(pos);
+        }
+    };
+
+    for (auto const& symbol : file.symbols) {
+        erase(symbols_by_name_, symbol.name);
+    }
+    for (auto const& ref : file.refs) {
+        erase(refs_by_decl_, decl_key(uri_to_path(ref.decl_file), ref.decl_line, ref.decl_column));
+    }
+}
+
+void WorkspaceIndex::remove(std::string const& uri)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    open_.erase(uri);
+    auto pos = files_.find(uri);
+    if (pos != files_.end()) {
+        remove_postings_(*pos->second);
+        files_.erase(pos);
+    }
+    search_.remove(uri);
+    dirty_ = true;
+}
+
+void WorkspaceIndex::reindex(std::string const& uri, CompileOption const& option)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        open_.erase(uri);
+        if (workers_.empty()) {
+            return;
+        }
+        jobs_.push_back({uri, option});
+    }
+    cv_.notify_one();
+}
+
+std::shared_ptr<const FileIndex> WorkspaceIndex::get(std::string const& uri)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto pos = files_.find(uri);
+    return pos != files_.end() ? pos->second : nullptr;
+}
+
+std::vector<IndexSymbol> WorkspaceIndex::lookup(std::string const& name)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::vector<IndexSymbol> symbols;
+    auto pos = symbols_by_name_.find(name);
+    if (pos == symbols_by_name_.end()) {
+        return symbols;
+    }
+
+    for (auto const& [uri, positions] : pos->second) {
+        auto const& file = *files_[uri];
+        for (auto i : positions) {
+            auto const& symbol = file.symbols[i];
+            // a header declaration shows up once for every file including it
+            auto same = [&symbol](IndexSymbol const& s) {
+                return s.file == symbol.file && s.line == symbol.line && s.column == symbol.column;
+            };
+            if (std::none_of(symbols.begin(), symbols.end(), same)) {
+                symbols.push_back(symbol);
+            }
+        }
+    }
+
+    return symbols;
+}
+
+std::vector<IndexRef> WorkspaceIndex::lookup_references(std::string const& name, std::string const& decl_path,
+                                                        const int decl_line, const int decl_column,
+                                                        std::string const& exclude_uri)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::vector<IndexRef> refs;
+    auto pos = refs_by_decl_.find(decl_key(decl_path, decl_line, decl_column));
+    if (pos == refs_by_decl_.end()) {
+        return refs;
+    }
+
+    for (auto const& [uri, positions] : pos->second) {
+        if (uri == exclude_uri) {
+            continue;
+        }
+
+        auto const& file = *files_[uri];
+        for (auto i : positions) {
+            if (file.refs[i].name == name) {
+                refs.push_back(file.refs[i]);
+            }
+        }
+    }
+
+    return refs;
+}
+
+std::vector<std::shared_ptr<const FileIndex>> WorkspaceIndex::files()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::vector<std::shared_ptr<const FileIndex>> files;
+    files.reserve(files_.size());
+    for (auto const& [uri, file] : files_) {
+        files.push_back(file);
+    }
+    return files;
+}
+
+std::vector<IndexSymbol> WorkspaceIndex::search(std::string_view query, const size_t limit)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return search_.search(query, limit);
+}
@@ -0,0 +1,165 @@
+#ifndef __GLSLX_WORKSPACE_INDEX_HPP__
+#define __GLSLX_WORKSPACE_INDEX_HPP__
+#include "args.hpp"
+#include "compute_inactive.hpp"
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+class Doc;
+
+// a top level declaration of an indexed file. locations are 1-based like glslang::TSourceLoc.
+struct IndexSymbol {
+    enum class Kind : uint8_t { Global, Function, Struct };
+
+    Kind kind;
+    std::string name;
+    std::string detail;
+    // file the symbol is declared in, a header for declarations reached through #include
+    std::string file;
+    int line;
+    int column;
+    // end of the body for functions, same as line/column otherwise
+    int end_line;
+    int end_column;
+};
+
+// use of a global or function declared in another file, a header the file includes
+struct IndexRef {
+    std::string name;
+    std::string decl_file;
+    int decl_line;
+    int decl_column;
+    std::string file;
+    int line;
+    int column;
+};
+
+// what the index keeps of one parsed file, nothing in it points into the AST
+struct FileIndex {
+    std::string uri;
+    // stable hashes of the text and the CompileOption the file was parsed with
+    uint64_t hash = 0;
+    uint64_t option_hash = 0;
+    std::vector<IndexSymbol> symbols;
+    std::vector<IndexRef> refs;
+    std::vector<ComputeInactiveHelper::Range> inactive_blocks;
+    // headers the file includes and the IncludeCache hash of their content
+    std::vector<std::pair<std::string, uint64_t>> includes;
+};
+
+uint64_t fingerprint(CompileOption const& option);
+
+// summary of a successfully parsed Doc
+FileIndex make_file_index(Doc& doc);
+
+// case-insensitive substring search over the symbol names of the indexed files. every 1 to 3
+// character gram of a name has a posting list, a query only checks the names on the shortest list of
+// its grams. a header declaration is kept once however many files include it. removed symbols stay on
+// the lists until the dead outnumber the live, then the lists are rebuilt.
+class SymbolSearch {
+public:
+    // replaces the symbols file->uri had
+    void add(FileIndex const& file);
+    void remove(std::string const& uri);
+    // at most limit symbols containing query, best fuzzy match first
+    std::vector<IndexSymbol> search(std::string_view query, const size_t limit) const;
+
+private:
+    struct Slot {
+        IndexSymbol symbol;
+        std::string lower;
+        // files declaring or including the symbol, 0 once it is gone
+        int refs = 0;
+    };
+
+    std::vector<Slot> slots_;
+    size_t dead_ = 0;
+    // file, position and name of a symbol to its slot
+    std::unordered_map<std::string, uint32_t> by_location_;
+    std::unordered_map<std::string, std::vector<uint32_t>> by_uri_;
+    std::unordered_map<uint32_t, std::vector<uint32_t>> postings_;
+
+    void post_(uint32_t slot);
+    void compact_();
+};
+
+// symbols of every shader in compile_commands_glslx.json. files are parsed with their own options
+// on a pool of threads in the background; editor parses replace the entries of open files.
+// the index is persisted when the pool runs dry. on startup the persisted entries answer queries
+// right away and the pool only reparses files whose text, options or headers changed since.
+class WorkspaceIndex {
+public:
+    WorkspaceIndex() = default;
+    WorkspaceIndex(const WorkspaceIndex&) = delete;
+    WorkspaceIndex& operator=(const WorkspaceIndex&) = delete;
+    ~WorkspaceIndex();
+
+    // load the index persisted at store_path, queue every file, keyed by uri, for revalidation and
+    // start the pool if it is not running. an empty store_path keeps the index in memory.
+    void start(std::map<std::string, CompileOption> const& files, std::string const& store_path = {},
+               unsigned threads = 0);
+    void stop();
+
+    // entry built from an editor parse, always newer than the one from disk
+    void update(FileIndex&& index);
+    void remove(std::string const& uri);
+    // the editor let go of uri, index it from the disk again
+    void reindex(std::string const& uri, CompileOption const& option);
+
+    std::shared_ptr<const FileIndex> get(std::string const& uri);
+    // declarations named name in any indexed file
+    std::vector<IndexSymbol> lookup(std::string const& name);
+    // uses of the declaration at decl_path:decl_line:decl_column in files other than exclude_uri, decl_path
+    // normalized like uri_to_path
+    std::vector<IndexRef> lookup_references(std::string const& name, std::string const& decl_path,
+                                            const int decl_line, const int decl_column,
+                                            std::string const& exclude_uri);
+    std::vector<std::shared_ptr<const FileIndex>> files();
+    // workspace/symbol, see SymbolSearch
+    std::vector<IndexSymbol> search(std::string_view query, const size_t limit);
+
+private:
+    struct Job {
+        std::string uri;
+        CompileOption option;
+    };
+
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    std::deque<Job> jobs_;
+    // jobs taken by a worker and not finished yet
+    int active_ = 0;
+    bool stop_ = false;
+    std::vector<std::thread> workers_;
+    std::map<std::string, std::shared_ptr<const FileIndex>> files_;
+    // follows files_
+    SymbolSearch search_;
+    // follow files_ too: declaration name, and normalized path, line and column of the referenced declaration,
+    // to the uris holding them and their positions in symbols or refs
+    std::unordered_map<std::string, std::map<std::string, std::vector<uint32_t>>> symbols_by_name_;
+    std::unordered_map<std::string, std::map<std::string, std::vector<uint32_t>>> refs_by_decl_;
+    // uris whose entry comes from the editor, the disk does not override them
+    std::set<std::string> open_;
+    std::string store_path_;
+    // entries changed since the store was written
+    bool dirty_ = false;
+    std::mutex store_mutex_;
+
+    void run_();
+    void index_file_(Job const& job);
+    void save_();
+    void set_file_(std::shared_ptr<const FileIndex> file);
+    void add_postings_(FileIndex const& file);
+    void remove_postings_(FileIndex const& file);
+};
+#endif